@@ -0,0 +1,92 @@
+/**
+ * @file await.c
+ *
+ * Cost per item of while_co_yield_await
+ *
+ * A consumer awaits every value of a generator, while a number of other coroutines
+ * wait for a condition and so stay runnable. Reports nanoseconds per item for 0 to
+ * 1024 of them. Built once with direct hand over (default) and once with
+ * CO_MULTI_CO_WQ_TRANSFER_DEPTH=0, where every resume goes through the queue.
+ *
+ * Usage: await [items] [max others]
+ *
+ */
+
+#include "bench.h"
+#include "co_coroutines.h"
+#include "co_shortcuts.h"
+#include "dep/co_primitive_allocator.h"
+
+#if CO_MULTI_CO_WQ_TRANSFER_DEPTH > 0
+#	define AWAIT_NAME "handover"
+#else
+#	define AWAIT_NAME "queued"
+#endif
+
+static co_multi_co_wq_t wq;
+static int items, stop;
+
+co_routine_decl(int, gen, int, i);
+co_routine_decl(long, consumer, struct gen_co_obj *, g);
+co_routine_decl(int, other, int, unused);
+
+co_yield_rv_t gen(struct gen_co_obj *self) {
+	co_routine_begin(self, gen);
+	for (_(i) = 0; _(i) < items; ++_(i)) {
+		co_yield_return(self, _(i));
+	}
+	co_yield_break();
+}
+
+co_yield_rv_t other(struct other_co_obj *self) {
+	co_routine_begin(self, other);
+	co_yield_wait_cond(self, stop);
+	co_yield_break();
+}
+
+co_yield_rv_t consumer(struct consumer_co_obj *self) {
+	co_routine_begin(self, consumer);
+	_(g) = co_fork_run(self, gen, 0);
+	while_co_yield_await(self, _(g)) {
+		++self->rv;
+	}
+	if (self->rv != items)
+		printf("consumed %ld of %d\n", self->rv, items);
+	stop         = 1;
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+/**
+ * Run one round with given number of other runnable coroutines
+ */
+static void measure(co_allocator_t *alloc, int others) {
+	unsigned long long t0;
+	int i;
+
+	stop = 0;
+	co_multi_co_wq_init(&wq, 8, alloc, alloc);
+	for (i = 0; i < others; ++i) {
+		struct other_co_obj *c = co_new(&wq, other, 0);
+		co_schedule(&wq, c);
+	}
+	{
+		struct consumer_co_obj *c = co_new(&wq, consumer, 0);
+		co_schedule(&wq, c);
+	}
+	t0 = bench_now_ns();
+	co_multi_co_wq_loop(&wq);
+	printf("%s, %4d others: %.1fns per item\n", AWAIT_NAME, others, (bench_now_ns() - t0) / (double)items);
+	co_multi_co_wq_destroy(&wq);
+}
+
+int main(int argc, char **argv) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	int max = argc > 2 ? atoi(argv[2]) : 1024, others;
+
+	items = argc > 1 ? atoi(argv[1]) : 4000000;
+	measure(&alloc, 0);
+	for (others = 16; others <= max; others *= 4)
+		measure(&alloc, others);
+	return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file bell.c
+ *
+ * Schedule to run latency of an idle work queue
+ *
+ * A foreign thread schedules one coroutine at a time on a work queue that sleeps
+ * on its bell, and waits until the coroutine runs. Once back to back, once with
+ * a pause in between, which lets the adaptive spin of the futex bell give up.
+ * Built once per bell: completion (default), futex and epoll.
+ *
+ * Usage: bell [iterations] [pause us]
+ *
+ */
+
+#include "bench.h"
+#include "co_coroutines.h"
+#include "dep/co_primitive_allocator.h"
+#include <sched.h>
+#include <unistd.h>
+
+#if defined(CO_MULTI_CO_WQ_FUTEX)
+#	define BELL_NAME "futex"
+#elif defined(CO_MULTI_CO_WQ_EPOLL)
+#	define BELL_NAME "epoll"
+#else
+#	define BELL_NAME "completion"
+#endif
+
+static co_multi_co_wq_t wq;
+static volatile unsigned long long ran_at;
+
+co_routine_decl(int, ping, int, unused);
+
+co_yield_rv_t ping(struct ping_co_obj *self) {
+	co_routine_begin(self, ping);
+	ran_at = bench_now_ns();
+	co_yield_break();
+}
+
+static void *loop(void *unused) {
+	(void)unused;
+	co_multi_co_wq_loop(&wq);
+	return NULL;
+}
+
+/**
+ * Schedule pings one by one, waiting for each to run
+ */
+static void measure(int n, int pause_us, unsigned long long *lat) {
+	char what[64];
+	int i;
+	for (i = 0; i < n; ++i) {
+		struct ping_co_obj *c = co_new(&wq, ping, 0);
+		unsigned long long t0;
+		if (pause_us)
+			usleep(pause_us);
+		ran_at = 0;
+		t0     = bench_now_ns();
+		co_schedule(&wq, c);
+		while (!ran_at)
+			sched_yield();
+		lat[i] = ran_at - t0;
+	}
+	snprintf(what, sizeof(what), "%s bell, %dus between", BELL_NAME, pause_us);
+	bench_report_latency(what, lat, n);
+}
+
+int main(int argc, char **argv) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	int n = argc > 1 ? atoi(argv[1]) : 20000, pause_us = argc > 2 ? atoi(argv[2]) : 50;
+	unsigned long long *lat = malloc(n * sizeof(*lat));
+	pthread_t th;
+
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	pthread_create(&th, NULL, loop, NULL);
+	usleep(10000); /* Let it fall asleep */
+
+	measure(n, 0, lat);
+	measure(n, pause_us, lat);
+
+	wq.terminate = 1;
+	co_multi_co_wq_ring_the_bell(&wq);
+	pthread_join(th, NULL);
+	co_multi_co_wq_destroy(&wq);
+	free(lat);
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef CO_BENCH_H
+#define CO_BENCH_H
+/**
+ * @file bench.h
+ *
+ * Helpers shared by benchmarks, see bench target of Makefile
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Monotonic time
+ * @return Nanoseconds
+ */
+static __inline__ unsigned long long bench_now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int __bench_cmp(const void *a, const void *b) {
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Print average and percentiles of latency samples, sorting them
+ * @param what Label
+ * @param ns Samples in nanoseconds
+ * @param n Number of samples
+ */
+static __inline__ void bench_report_latency(const char *what, unsigned long long *ns, int n) {
+	unsigned long long sum = 0;
+	int i;
+	for (i = 0; i < n; ++i)
+		sum += ns[i];
+	qsort(ns, n, sizeof(*ns), __bench_cmp);
+	printf("%s: avg %.1fus p50 %.1fus p99 %.1fus max %.1fus\n", what, sum / 1e3 / n, ns[n / 2] / 1e3,
+	       ns[n * 99 / 100] / 1e3, ns[n - 1] / 1e3);
+}
+
+#endif /*CO_BENCH_H*/
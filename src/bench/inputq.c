@@ -0,0 +1,92 @@
+/**
+ * @file inputq.c
+ *
+ * Input queue contention
+ *
+ * N producer threads schedule pre-allocated coroutines on one work queue at once,
+ * while its loop drains them. Reports the average time a producer spends per
+ * schedule and the total time until all coroutines ran, for 1 to 64 producers.
+ * Built once per input queue: sharded (default) and mpsc.
+ *
+ * Usage: inputq [coroutines] [max producers]
+ *
+ */
+
+#include "bench.h"
+#include "co_coroutines.h"
+#include "dep/co_primitive_allocator.h"
+
+#ifdef CO_MULTI_CO_WQ_MPSC
+#	define INPUTQ_NAME "mpsc"
+#else
+#	define INPUTQ_NAME "sharded"
+#endif
+
+#define INPUTQ_MAX_PRODUCERS (64)
+
+static co_multi_co_wq_t wq;
+static int ran, total, per_producer;
+static unsigned long long enq_ns;
+
+co_routine_decl(int, job, int, unused);
+
+co_yield_rv_t job(struct job_co_obj *self) {
+	co_routine_begin(self, job);
+	if (++ran == total)
+		wq.terminate = 1;
+	co_yield_break();
+}
+
+static struct job_co_obj **jobs;
+
+static void *producer(void *arg) {
+	struct job_co_obj **mine = jobs + (long)arg * per_producer;
+	unsigned long long t0    = bench_now_ns();
+	int i;
+	for (i = 0; i < per_producer; ++i) {
+		co_schedule(&wq, mine[i]);
+	}
+	__sync_fetch_and_add(&enq_ns, bench_now_ns() - t0);
+	return NULL;
+}
+
+/**
+ * Run one round with given number of producers
+ */
+static void measure(co_allocator_t *alloc, int n, int np) {
+	pthread_t th[INPUTQ_MAX_PRODUCERS];
+	unsigned long long t0;
+	long k;
+	int i;
+
+	per_producer = n / np;
+	total        = per_producer * np;
+	ran          = 0;
+	enq_ns       = 0;
+	co_multi_co_wq_init(&wq, 8, alloc, alloc);
+	for (i = 0; i < total; ++i)
+		jobs[i] = co_new(&wq, job, 0);
+
+	t0 = bench_now_ns();
+	for (k = 0; k < np; ++k)
+		pthread_create(&th[k], NULL, producer, (void *)k);
+	co_multi_co_wq_loop(&wq);
+	for (k = 0; k < np; ++k)
+		pthread_join(th[k], NULL);
+	printf("%s, %2d producers: total %.1fms, %.1fns per schedule\n", INPUTQ_NAME, np, (bench_now_ns() - t0) / 1e6,
+	       (double)enq_ns / total);
+	co_multi_co_wq_destroy(&wq);
+}
+
+int main(int argc, char **argv) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	int n = argc > 1 ? atoi(argv[1]) : 1 << 20, max = argc > 2 ? atoi(argv[2]) : INPUTQ_MAX_PRODUCERS, np;
+
+	if (max > INPUTQ_MAX_PRODUCERS)
+		max = INPUTQ_MAX_PRODUCERS;
+	jobs = malloc(n * sizeof(*jobs));
+	for (np = 1; np <= max; np *= 2)
+		measure(&alloc, n, np);
+	free(jobs);
+	return 0;
+}
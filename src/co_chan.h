@@ -0,0 +1,346 @@
+#ifndef CO_CHAN_H
+#define CO_CHAN_H
+/**
+ * @file co_chan.h
+ *
+ * Channels
+ *
+ * Bounded FIFO of fixed size elements between coroutines. A sender finding the channel
+ * full, or a receiver finding it empty, is parked until the other side makes room or
+ * brings an element, so waiting costs nothing to the work queue loop. Elements are
+ * copied in and out, unlike co_yield_return there is no lockstep between the two sides:
+ * a producer may run ahead of its consumer by up to the channel capacity.
+ *
+ * Two flavours:
+ *    co_chan_t - all endpoints live on the same work queue. No atomics, no locks, a
+ *    plain ring buffer and two queues of parked coroutines.
+ *
+ *    co_chan_mt_t - endpoints may live on different work queues, or be plain threads
+ *    that only try. Lock free bounded MPMC ring, each slot carrying a sequence number
+ *    telling whether it is free or full for a given lap. Parked coroutines wait on
+ *    co_waitq_t, which is only locked when someone is actually waiting.
+ *
+ */
+
+#include "co_coroutines.h"
+#include "co_waitq.h"
+#include "dep/co_alloc.h"
+#include "dep/co_atomics.h"
+#include "dep/co_list.h"
+#include "dep/co_types.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Channel object, all endpoints on the same work queue
+ */
+typedef struct co_chan {
+	/** Ring buffer */
+	char *buf;
+	/** Size of element */
+	co_size_t elem_size;
+	/** Number of elements channel holds */
+	co_size_t cap;
+	/** First element */
+	co_size_t head;
+	/** Number of elements held */
+	co_size_t count;
+	/** Coroutines parked on full channel */
+	co_queue_t senders;
+	/** Coroutines parked on empty channel */
+	co_queue_t receivers;
+} co_chan_t;
+
+/**
+ * Initialize channel
+ * @param ch Channel pointer
+ * @param cap Capacity, at least 1
+ * @param elem_size Size of element
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_chan_init(co_chan_t *ch, co_size_t cap, co_size_t elem_size) {
+	if (!cap || !elem_size)
+		return -EINVAL;
+	if ((ch->buf = co_malloc(cap * elem_size)) == NULL)
+		return -ENOMEM;
+	ch->elem_size = elem_size;
+	ch->cap       = cap;
+	ch->head      = 0;
+	ch->count     = 0;
+	ch->senders   = co_q_init();
+	ch->receivers = co_q_init();
+	return 0;
+}
+
+/**
+ * Destroy channel
+ * No coroutine may be parked on it any more.
+ * @param ch Channel pointer
+ */
+static __inline__ void co_chan_destroy(co_chan_t *ch) { co_free(ch->buf); }
+
+/**
+ * Reschedule first coroutine parked on one side of channel
+ * @note Internal
+ */
+static __inline__ void __co_chan_wake(co_queue_t *q) {
+	co_list_e_t *e = co_q_peek(q);
+	if (e) {
+		co_coroutine_obj_t *co = __co_container_of(e, co_coroutine_obj_t, qe);
+		co_q_deq(q);
+		co_multi_co_wq_enq(co->wq, co);
+	}
+}
+
+/**
+ * Put element into channel, unless it is full
+ * @param ch Channel pointer
+ * @param elem Element to copy in
+ * @return 1 if sent, 0 if channel is full
+ */
+static __inline__ co_bool_t co_chan_try_send(co_chan_t *ch, const void *elem) {
+	co_size_t i;
+	if (ch->count == ch->cap)
+		return 0;
+	i = ch->head + ch->count;
+	if (i >= ch->cap)
+		i -= ch->cap;
+	memcpy(ch->buf + i * ch->elem_size, elem, ch->elem_size);
+	++ch->count;
+	__co_chan_wake(&ch->receivers);
+	return 1;
+}
+
+/**
+ * Take element out of channel, unless it is empty
+ * @param ch Channel pointer
+ * @param elem Where to copy element out
+ * @return 1 if received, 0 if channel is empty
+ */
+static __inline__ co_bool_t co_chan_try_recv(co_chan_t *ch, void *elem) {
+	if (!ch->count)
+		return 0;
+	memcpy(elem, ch->buf + ch->head * ch->elem_size, ch->elem_size);
+	if (++ch->head == ch->cap)
+		ch->head = 0;
+	--ch->count;
+	__co_chan_wake(&ch->senders);
+	return 1;
+}
+
+/**
+ * Send element, yield and park coroutine while channel is full
+ * @param self Calling coroutine
+ * @param ch Channel pointer
+ * @param elem Element to copy in, re-evaluated after yield, so must not point to C locals
+ */
+#define co_yield_chan_send(self, ch, elem)                                                                             \
+	while (!co_chan_try_send(ch, elem)) {                                                                              \
+		co_q_enq(&(ch)->senders, &(self)->obj.qe);                                                                     \
+		co_yield_park(self);                                                                                           \
+	}
+
+/**
+ * Receive element, yield and park coroutine while channel is empty
+ * @param self Calling coroutine
+ * @param ch Channel pointer
+ * @param elem Where to copy element out, re-evaluated after yield, so must not point to C locals
+ */
+#define co_yield_chan_recv(self, ch, elem)                                                                             \
+	while (!co_chan_try_recv(ch, elem)) {                                                                              \
+		co_q_enq(&(ch)->receivers, &(self)->obj.qe);                                                                   \
+		co_yield_park(self);                                                                                           \
+	}
+
+/**
+ * Channel object, endpoints on any work queue
+ */
+typedef struct co_chan_mt {
+	/** Next slot to send to, on a cache line of its own */
+	uintptr_t tail __attribute__((aligned(64)));
+	/** Next slot to receive from, on a cache line of its own */
+	uintptr_t head __attribute__((aligned(64)));
+	/** Slots, each a sequence number followed by element */
+	char *buf __attribute__((aligned(64)));
+	/** Number of slots minus one, a power of 2 minus one */
+	co_size_t mask;
+	/** Size of element */
+	co_size_t elem_size;
+	/** Size of slot */
+	co_size_t slot_size;
+	/** Number of senders about to park, or parked */
+	co_atom_t send_waiting;
+	/** Number of receivers about to park, or parked */
+	co_atom_t recv_waiting;
+	/** Senders parked on full channel */
+	co_waitq_t senders;
+	/** Receivers parked on empty channel */
+	co_waitq_t receivers;
+} co_chan_mt_t;
+
+#define __co_chan_mt_slot(ch, pos) ((ch)->buf + ((pos) & (ch)->mask) * (ch)->slot_size)
+#define __co_chan_mt_seq(slot)     __atomic_load_n((uintptr_t *)(slot), __ATOMIC_ACQUIRE)
+
+/**
+ * Initialize channel
+ * @param ch Channel pointer
+ * @param cap Capacity, at least 1, rounded up to a power of 2, at least 2
+ * @param elem_size Size of element
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_chan_mt_init(co_chan_mt_t *ch, co_size_t cap, co_size_t elem_size) {
+	co_size_t n = 2, i; /* Free and full sequence numbers of a single slot would be the same */
+	if (!cap || !elem_size)
+		return -EINVAL;
+	while (n < cap)
+		n <<= 1;
+	ch->slot_size = (sizeof(uintptr_t) + elem_size + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+	if ((ch->buf = co_malloc_memalign(64, n * ch->slot_size)) == NULL)
+		return -ENOMEM;
+	ch->mask = n - 1;
+	for (i = 0; i < n; ++i)
+		*(uintptr_t *)__co_chan_mt_slot(ch, i) = i; /* Free for lap 0 */
+	ch->elem_size    = elem_size;
+	ch->tail         = 0;
+	ch->head         = 0;
+	ch->send_waiting = co_atom_init(0);
+	ch->recv_waiting = co_atom_init(0);
+	ch->senders      = co_waitq_init();
+	ch->receivers    = co_waitq_init();
+	return 0;
+}
+
+/**
+ * Destroy channel
+ * No coroutine may be parked on it, nor thread use it, any more.
+ * @param ch Channel pointer
+ */
+static __inline__ void co_chan_mt_destroy(co_chan_mt_t *ch) { co_free(ch->buf); }
+
+/**
+ * Check whether channel is full, may be stale by the time it returns
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_chan_mt_full(co_chan_mt_t *ch) {
+	uintptr_t pos = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+	return (intptr_t)(__co_chan_mt_seq(__co_chan_mt_slot(ch, pos)) - pos) < 0;
+}
+
+/**
+ * Check whether channel is empty, may be stale by the time it returns
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_chan_mt_empty(co_chan_mt_t *ch) {
+	uintptr_t pos = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+	return (intptr_t)(__co_chan_mt_seq(__co_chan_mt_slot(ch, pos)) - (pos + 1)) < 0;
+}
+
+/**
+ * Wake up one waiter of one side of channel, if any may be waiting
+ * Slot was published by an exchange, a full barrier, and waiters count themselves by
+ * an atomic add before they test the channel, so either the waiter sees the change
+ * the waker just made, and does not park, or the waker sees the waiter.
+ * Waker takes woken up waiter out of the count, so that the other side does not keep
+ * taking the wait queue lock until it runs.
+ * @note Internal
+ */
+static __inline__ void __co_chan_mt_wake(co_multi_co_wq_t *wq, co_atom_t *waiting, co_waitq_t *waitq) {
+	if (__atomic_load_n(&waiting->counter, __ATOMIC_SEQ_CST)) {
+		co_coroutine_obj_t *co = __co_waitq_take_one(waitq);
+		if (co) {
+			co_atom_sub(waiting, 1);
+			__co_waitq_resume(wq, co);
+		}
+	}
+}
+
+/**
+ * Put element into channel, unless it is full, from any context
+ * @param wq Work queue of the caller, or NULL if caller is not a coroutine
+ * @param ch Channel pointer
+ * @param elem Element to copy in
+ * @return 1 if sent, 0 if channel is full
+ */
+static __inline__ co_bool_t co_chan_mt_try_send(co_multi_co_wq_t *wq, co_chan_mt_t *ch, const void *elem) {
+	uintptr_t pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED), seq;
+	char *slot;
+	for (;;) {
+		slot = __co_chan_mt_slot(ch, pos);
+		seq  = __co_chan_mt_seq(slot);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&ch->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((intptr_t)(seq - pos) < 0) {
+			return 0; /* Slot still full from previous lap */
+		} else {
+			pos = __atomic_load_n(&ch->tail, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(slot + sizeof(uintptr_t), elem, ch->elem_size);
+	__atomic_exchange_n((uintptr_t *)slot, pos + 1, __ATOMIC_SEQ_CST);
+	__co_chan_mt_wake(wq, &ch->recv_waiting, &ch->receivers);
+	return 1;
+}
+
+/**
+ * Take element out of channel, unless it is empty, from any context
+ * @param wq Work queue of the caller, or NULL if caller is not a coroutine
+ * @param ch Channel pointer
+ * @param elem Where to copy element out
+ * @return 1 if received, 0 if channel is empty
+ */
+static __inline__ co_bool_t co_chan_mt_try_recv(co_multi_co_wq_t *wq, co_chan_mt_t *ch, void *elem) {
+	uintptr_t pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED), seq;
+	char *slot;
+	for (;;) {
+		slot = __co_chan_mt_slot(ch, pos);
+		seq  = __co_chan_mt_seq(slot);
+		if (seq == pos + 1) {
+			if (__atomic_compare_exchange_n(&ch->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((intptr_t)(seq - (pos + 1)) < 0) {
+			return 0; /* Slot not filled yet */
+		} else {
+			pos = __atomic_load_n(&ch->head, __ATOMIC_RELAXED);
+		}
+	}
+	memcpy(elem, slot + sizeof(uintptr_t), ch->elem_size);
+	__atomic_exchange_n((uintptr_t *)slot, pos + ch->mask + 1, __ATOMIC_SEQ_CST); /* Free for next lap */
+	__co_chan_mt_wake(wq, &ch->send_waiting, &ch->senders);
+	return 1;
+}
+
+/**
+ * Send element, yield and park coroutine while channel is full
+ * @param self Calling coroutine
+ * @param ch Channel pointer
+ * @param elem Element to copy in, re-evaluated after yield, so must not point to C locals
+ */
+#define co_yield_chan_mt_send(self, ch, elem)                                                                          \
+	while (!co_chan_mt_try_send((self)->obj.wq, ch, elem)) {                                                           \
+		co_atom_add(&(ch)->send_waiting, 1);                                                                           \
+		if (__co_waitq_park_unless(&(ch)->senders, &(self)->obj, !__co_chan_mt_full(ch))) {                            \
+			co_yield_park(self); /* Waker takes it out of the count */                                                 \
+		} else {                                                                                                       \
+			co_atom_sub(&(ch)->send_waiting, 1);                                                                       \
+		}                                                                                                              \
+	}
+
+/**
+ * Receive element, yield and park coroutine while channel is empty
+ * @param self Calling coroutine
+ * @param ch Channel pointer
+ * @param elem Where to copy element out, re-evaluated after yield, so must not point to C locals
+ */
+#define co_yield_chan_mt_recv(self, ch, elem)                                                                          \
+	while (!co_chan_mt_try_recv((self)->obj.wq, ch, elem)) {                                                           \
+		co_atom_add(&(ch)->recv_waiting, 1);                                                                           \
+		if (__co_waitq_park_unless(&(ch)->receivers, &(self)->obj, !__co_chan_mt_empty(ch))) {                         \
+			co_yield_park(self); /* Waker takes it out of the count */                                                 \
+		} else {                                                                                                       \
+			co_atom_sub(&(ch)->recv_waiting, 1);                                                                       \
+		}                                                                                                              \
+	}
+
+#endif /*CO_CHAN_H*/
@@ -9,7 +9,9 @@
 
 #include "dep/co_dbg.h"
 #include "dep/co_list.h"
+#include "dep/co_pairing_heap.h"
 #include "dep/co_sync.h"
+#include "dep/co_timer_wheel.h"
 #include "dep/co_types.h"
 
 struct co_coroutine_obj;
@@ -31,6 +33,8 @@ typedef enum co_yield_rv {
 	CO_RV_YIELD_AWAIT,
 	/** Not terminated, waiting on condition, can be rerun to test condition */
 	CO_RV_YIELD_COND_WAIT,
+	/** Not terminated, parked off execq, whoever it is parked on will reschedule it */
+	CO_RV_YIELD_PARK,
 	/** Unexpected error during the execution */
 	CO_RV_YIELD_ERROR
 } co_yield_rv_t;
@@ -58,9 +62,35 @@ typedef enum co_routine_flag {
 	CO_FLAG_SLOW_ALLOC,
 	/** Is set on coroutine after it terminated, just before it is destroyed, to notify its callers */
 	CO_FLAG_TERM,
+	/** Coroutine is parked until its bell rings */
+	CO_FLAG_PARKED,
+	/** Coroutine is paused, loop drops it instead of running */
+	CO_FLAG_PAUSED,
+	/** Paused coroutine was dropped by the loop, it is in no queue until co_run */
+	CO_FLAG_HELD,
+	/** Corotine object lives in storage of its owner, never freed */
+	CO_FLAG_INPLACE,
+	/** Coroutine is cancelled, see co_cancel */
+	CO_FLAG_CANCEL,
+	/** Cancellation was taken, coroutine runs its cancellation handler */
+	CO_FLAG_CANCEL_TAKEN,
+	/** Deadline of the last await with deadline expired first, see co_yield_await_timeout */
+	CO_FLAG_TIMEDOUT,
 } co_routine_flag_t;
 
-#define co_routine_flags_init() ((co_routine_flags_bmp_t)0)
+/** Bits of flags bitmap from this one up to the pool id hold priority level of coroutine, see co_set_prio */
+#define CO_FLAGS_PRIO_SHIFT (10)
+/** Bits of flags bitmap above this one hold frame pool id of coroutine, see co_routine_decl_pooled */
+#define CO_FLAGS_POOL_SHIFT (16)
+
+#define CO_FLAGS_PRIO_MASK ((co_routine_flags_bmp_t)((1 << CO_FLAGS_POOL_SHIFT) - (1 << CO_FLAGS_PRIO_SHIFT)))
+
+#define co_routine_flags_init() ((co_routine_flags_bmp_t)CO_PRIO_DEFAULT << CO_FLAGS_PRIO_SHIFT)
+
+#define co_routine_flags_prio(flags) (((unsigned)(flags) & CO_FLAGS_PRIO_MASK) >> CO_FLAGS_PRIO_SHIFT)
+
+#define co_routine_flags_pool(flags) ((unsigned)(flags) >> CO_FLAGS_POOL_SHIFT)
+#define co_routine_flags_set_pool(flags, pool) (*(flags) |= (co_routine_flags_bmp_t)(pool) << CO_FLAGS_POOL_SHIFT)
 
 static __inline__ int co_routine_flag_test(co_routine_flags_bmp_t flags, co_routine_flag_t flag) {
 	return flags & (1 << flag);
@@ -72,10 +102,51 @@ static __inline__ void co_routine_flag_clear(co_routine_flags_bmp_t *flags, co_r
 	*flags &= ~(1 << flag);
 }
 
+/*
+ * Atomic variants, for flags that are shared with other threads
+ */
+static __inline__ void co_routine_flag_set_atomic(co_routine_flags_bmp_t *flags, co_routine_flag_t flag) {
+	co_word_or(flags, 1 << flag);
+}
+static __inline__ void co_routine_flag_clear_atomic(co_routine_flags_bmp_t *flags, co_routine_flag_t flag) {
+	co_word_and(flags, ~(1 << flag));
+}
+
 #define co_routine_flag_set_alloc(flags, alloc) __co_cat_2(co_routine_flag_set_alloc_, alloc)(flags)
 #define co_routine_flag_set_alloc_fast(flags) co_routine_flag_clear(flags, CO_FLAG_SLOW_ALLOC)
 #define co_routine_flag_set_alloc_slow(flags) co_routine_flag_set(flags, CO_FLAG_SLOW_ALLOC)
 
+#ifdef CO_MULTI_CO_WQ_GROUPS
+/**
+ * Countdown of children a coroutine awaits all together, see co_yield_await_all
+ */
+typedef struct co_await_group {
+	/** Awaiting coroutine */
+	struct co_coroutine_obj *parent;
+	/** Children still running */
+	co_size_t pending;
+	/** Parent is woken up when pending drops to this */
+	co_size_t wake_at;
+	/** First child to terminate since group was armed, or NULL */
+	struct co_coroutine_obj *first;
+} co_await_group_t;
+#endif
+
+/**
+ * Wake up timer of sleeping coroutine, allocated for as long as it sleeps, see co_multi_co_wq_sleep
+ */
+typedef struct co_sleep {
+	/** Timer in timer wheel of work queue */
+	co_timer_t timer;
+	/** Sleeping coroutine */
+	struct co_coroutine_obj *co;
+} co_sleep_t;
+
+/* Children are linked to their parent to be cancelled along with it, and to count deadline misses once */
+#if defined(CO_MULTI_CO_WQ_CANCEL) || defined(CO_MULTI_CO_WQ_EDF)
+#	define CO_COROUTINE_OBJ_CHILDREN
+#endif
+
 /**
  * Generic coroutine object
  */
@@ -92,12 +163,45 @@ typedef struct co_coroutine_obj {
 	co_routine_flags_bmp_t flags;
 	/** Pointer to all the coroutines awaiting for current coroutine */
 	co_list_e_t *await;
+	/** Wake up timer while coroutine sleeps, else NULL */
+	co_sleep_t *sleep;
+#ifdef CO_MULTI_CO_WQ_AWAIT_TIMEOUT
+	/** Coroutine awaited until timer expires, whose await list this one is in, or NULL */
+	struct co_coroutine_obj *awaited;
+#endif
+#ifdef CO_COROUTINE_OBJ_CHILDREN
+	/** Children forked and still running, see co_fork */
+	co_hlist_t children;
+	/** Element of children list of parent, unlinked once either terminates */
+	co_hlist_e_t sibling;
+#endif
+#ifdef CO_MULTI_CO_WQ_CANCEL
+	/** Resume position of cancellation handler, 0 if none, see co_on_cancel */
+	co_ipointer_t cancel_ip;
+#endif
+#ifdef CO_MULTI_CO_WQ_GROUPS
+	/** Await group to tell when terminated, or NULL */
+	co_await_group_t *group;
+#endif
+#ifdef CO_MULTI_CO_WQ_ARENA
+	/** Size of the whole coroutine frame */
+	unsigned size;
+	/** Arena the object is allocated from, or NULL */
+	struct co_arena *arena;
+#endif
+#ifdef CO_MULTI_CO_WQ_EDF
+	/** Deadline, invalid if none, see co_set_deadline */
+	co_abstime_t deadline;
+	/** Element of deadline ordered execq, while queued to run with a deadline */
+	co_pheap_e_t he;
+#endif
 
 	/** Debug only trace function name */
 	co_dbg(const char *func_name);
 } co_coroutine_obj_t;
 
 void static __inline__ co_multi_co_wq_ring_the_bell(struct co_multi_co_wq *wq);
+void static __inline__ co_multi_co_wq_wake(struct co_multi_co_wq *wq, struct co_coroutine_obj *co);
 
 /**
  * Test whether coroutine is terminated
@@ -108,23 +212,179 @@ static __inline__ int co_is_terminated(const co_coroutine_obj_t *co) {
 	return co_routine_flag_test(co->flags, CO_FLAG_TERM);
 }
 
+/**
+ * Test whether coroutine is cancelled
+ * Like co_is_terminated, stays valid for those it wakes up once terminated.
+ * @param co Coroutine object pointer
+ * @return 1 if cancelled else 0
+ */
+static __inline__ int co_is_cancelled(const co_coroutine_obj_t *co) {
+	return co_routine_flag_test(co->flags, CO_FLAG_CANCEL);
+}
+
+/**
+ * Take cancellation of coroutine, once, on its first resume since cancelled
+ * @param co Coroutine object pointer, cancelled and not taken yet
+ * @return 1 if coroutine is to resume in its cancellation handler, 0 if it has none and is to terminate right away
+ */
+static __inline__ int co_coroutine_obj_take_cancel(co_coroutine_obj_t *co) {
+	co_routine_flag_set_atomic(&co->flags, CO_FLAG_CANCEL_TAKEN);
+#ifdef CO_MULTI_CO_WQ_CANCEL
+	if (!co->cancel_ip)
+		return 0;
+	co->ip = co->cancel_ip;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * Test whether coroutine is cancelled, and did not take it yet
+ * @param co Coroutine object pointer
+ * @return 1 if cancellation is due else 0
+ */
+static __inline__ int co_coroutine_obj_cancel_due(const co_coroutine_obj_t *co) {
+#ifdef CO_MULTI_CO_WQ_CANCEL
+	return (co->flags & (1 << CO_FLAG_CANCEL | 1 << CO_FLAG_CANCEL_TAKEN)) == 1 << CO_FLAG_CANCEL;
+#else
+	return 0; /* Nobody cancels */
+#endif
+}
+
+/**
+ * Get priority level of coroutine
+ * @param co Coroutine object pointer
+ * @return Priority level, 0 is the highest
+ */
+static __inline__ unsigned co_coroutine_obj_prio(const co_coroutine_obj_t *co) {
+	return co_routine_flags_prio(co->flags);
+}
+
+/**
+ * Set priority level of coroutine
+ * Flags may be changed by other threads meanwhile, if coroutine is parked.
+ * @param co Coroutine object pointer
+ * @param prio Priority level, 0 is the highest
+ */
+static __inline__ void co_coroutine_obj_set_prio(co_coroutine_obj_t *co, unsigned prio) {
+	co_routine_flags_bmp_t old;
+	do {
+		old = co->flags;
+	} while (co_word_cmpxchg(&co->flags, old,
+	                         (old & ~CO_FLAGS_PRIO_MASK) | (co_routine_flags_bmp_t)prio << CO_FLAGS_PRIO_SHIFT) != old);
+}
+
+/**
+ * Pass scheduling attributes of parent on to its child: priority level, and deadline if any
+ * Child is linked to children of parent too, if they are tracked.
+ * @param child Child coroutine object pointer, not queued yet
+ * @param parent Parent coroutine object pointer
+ */
+static __inline__ void co_coroutine_obj_inherit(co_coroutine_obj_t *child, co_coroutine_obj_t *parent) {
+	child->flags = (child->flags & ~CO_FLAGS_PRIO_MASK) | (parent->flags & CO_FLAGS_PRIO_MASK);
+#ifdef CO_MULTI_CO_WQ_EDF
+	child->deadline = parent->deadline;
+#endif
+#ifdef CO_COROUTINE_OBJ_CHILDREN
+	co_hlist_add(&parent->children, &child->sibling);
+#endif
+}
+
+/**
+ * Test whether coroutine may migrate to another work queue
+ * Only root coroutines that did not start yet qualify: nothing else on the
+ * work queue can reference them, and their frame came from the slow allocator,
+ * which may be used from any thread.
+ * @param co Coroutine object pointer
+ * @return 1 if coroutine can migrate else 0
+ */
+static __inline__ int co_is_migratable(const co_coroutine_obj_t *co) {
+#ifdef CO_MULTI_CO_WQ_GROUPS
+	if (co->group)
+		return 0;
+#endif
+	return co->ip == CO_IPOINTER_START && co->await == NULL &&
+	       co_routine_flag_test(co->flags, CO_FLAG_SLOW_ALLOC) && !co_routine_flag_test(co->flags, CO_FLAG_TERM);
+}
+
 /**
  * Force terminate coroutine
  * @param co Coroutine object pointer
  * @warning It is forced action, coroutine will not know it is
  *          going to terminate, so if it had to free resources they will leak.
+ *          See co_cancel for cooperative termination.
  */
 static __inline__ void co_force_terminate(co_coroutine_obj_t *co) {
-	co_routine_flag_set(&co->flags, CO_FLAG_TERM);
+	co_routine_flag_set_atomic(&co->flags, CO_FLAG_TERM);
+}
+
+/**
+ * Mark coroutine as paused, unless the loop already dropped it
+ * @param co Coroutine object pointer
+ */
+static __inline__ void co_coroutine_obj_pause(co_coroutine_obj_t *co) {
+	if (!co_routine_flag_test(co->flags, CO_FLAG_HELD))
+		co_routine_flag_set_atomic(&co->flags, CO_FLAG_PAUSED);
+}
+
+/**
+ * Drop paused coroutine the loop was about to run, marking it held until co_run
+ * @param co Coroutine object pointer
+ * @return 1 if it was paused and is dropped, else 0
+ */
+static __inline__ int co_coroutine_obj_hold(co_coroutine_obj_t *co) {
+	co_routine_flags_bmp_t old;
+	if (!co_routine_flag_test(co->flags, CO_FLAG_PAUSED))
+		return 0; /* Common case, no need for atomic */
+	do {
+		old = co->flags;
+	} while (co_word_cmpxchg(&co->flags, old, (old & ~(1 << CO_FLAG_PAUSED)) | (1 << CO_FLAG_HELD)) != old);
+	return 1;
+}
+
+/**
+ * Clear paused mark of coroutine
+ * @param co Coroutine object pointer
+ * @return 1 if the loop did not drop it yet, so it is still wherever it was paused, else 0
+ */
+static __inline__ int co_coroutine_obj_unpause(co_coroutine_obj_t *co) {
+	if (co_routine_flag_test(co->flags, CO_FLAG_HELD)) {
+		co_routine_flag_clear_atomic(&co->flags, CO_FLAG_HELD);
+		return 0;
+	}
+	if (!co_routine_flag_test(co->flags, CO_FLAG_PAUSED))
+		return 0; /* Common case, no need for atomic */
+	return co_routine_flag_test(co_word_and(&co->flags, ~(1 << CO_FLAG_PAUSED)), CO_FLAG_PAUSED);
+}
+
+/**
+ * Park coroutine until its bell rings, unless it already did
+ * @param co Coroutine object pointer
+ * @return 1 if parked, 0 if already ready
+ */
+static __inline__ int co_coroutine_obj_park(co_coroutine_obj_t *co) {
+	co_routine_flags_bmp_t old;
+	do {
+		old = co->flags;
+		if (co_routine_flag_test(old, CO_FLAG_READY))
+			return 0;
+	} while (co_word_cmpxchg(&co->flags, old, old | (1 << CO_FLAG_PARKED)) != old);
+	return 1;
 }
 
 /**
- * Activate the bell event of coroutine's work queue
+ * Ring the bell of coroutine, can be called from any thread
+ * Marks coroutine as ready. If it is parked waiting for it, wakes up this coroutine only.
  * @param co Coroutine object pointer
  */
 void static __inline__ co_coroutine_obj_ring_the_bell(co_coroutine_obj_t *co) {
-	co_routine_flag_set(&co->flags, CO_FLAG_READY);
-	co_multi_co_wq_ring_the_bell(co->wq);
+	co_routine_flags_bmp_t old;
+	do {
+		old = co->flags;
+	} while (co_word_cmpxchg(&co->flags, old, (old | (1 << CO_FLAG_READY)) & ~(1 << CO_FLAG_PARKED)) != old);
+	if (co_routine_flag_test(old, CO_FLAG_PARKED))
+		co_multi_co_wq_wake(co->wq, co);
 }
 
 #endif /*CO_COROUTINE_OBJECT_G*/
\ No newline at end of file
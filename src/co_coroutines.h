@@ -20,6 +20,8 @@
 #define co_wrapper_fname(fname) __co_cat_2(fname, _co_wrapper)
 #define co_body_fname(fname) fname
 #define co_sync_fname(fname) __co_cat_2(fname, _co_sync)
+#define co_pool_fname(fname) __co_cat_2(fname, _co_pool)
+#define co_pool_id_fname(fname) __co_cat_2(fname, _co_pool_id)
 
 /*
  * Labels section
@@ -27,6 +29,7 @@
 #define co_gen_label(labael, n) __co_cat_2(labael, n)
 #define co_label_checkpoint co_gen_label(__co_label_checkpoint_, __LINE__)
 #define co_label_checkpoint_await co_gen_label(__co_label_checkpoint_await_, __LINE__)
+#define co_label_checkpoint_cancel co_gen_label(__co_label_checkpoint_cancel_, __LINE__)
 #define co_label_checkpoint_1 co_gen_label(__co_label_checkpoint_1_, __LINE__)
 #define co_label_checkpoint_2 co_gen_label(__co_label_checkpoint_2_, __LINE__)
 
@@ -53,36 +56,110 @@
 #define co_routine_ctx_init(fname, wqptr, ...)                                                                         \
 	(struct co_ctx_tname(fname)) {                                                                                     \
 		.obj.wq = wqptr, .obj.flags = co_routine_flags_init(), .obj.func = co_wrapper_fname(fname),                    \
-		.obj.ip = CO_IPOINTER_START, .obj.await = NULL, .args = {__VA_ARGS__}, .locs = NULL,                           \
+		.obj.ip = CO_IPOINTER_START, .obj.await = NULL, .args = {__VA_ARGS__},                                         \
+		.locs = NULL,                                                                                                  \
 		co_dbg(.obj.func_name = __co_stringify(fname))                                                                 \
 	}
 
+/**
+ * Allocate coroutine frame, frames on fast allocator come from frame pool of coroutine type if it has one
+ * @note Internal
+ */
+#define __co_new_frame(wq, alloc, fname) __co_cat_2(__co_new_frame_, alloc)(wq, fname)
+#define __co_new_frame_fast(wq, fname)                                                                                 \
+	co_multi_co_wq_alloc_pooled(wq, co_pool_fname(fname)(), sizeof(struct co_ctx_tname(fname)))
+#define __co_new_frame_slow(wq, fname) co_multi_co_wq_alloc_slow(wq, sizeof(struct co_ctx_tname(fname)))
+
+#ifdef CO_MULTI_CO_WQ_ARENA
+/**
+ * Allocate coroutine frame from arena, or as __co_new_frame does if arena is NULL
+ * @note Internal
+ */
+#	define __co_new_frame_from(wq, alloc, arena, fname)                                                                \
+		((arena) ? co_arena_alloc(arena, sizeof(struct co_ctx_tname(fname))) : __co_new_frame(wq, alloc, fname))
+/**
+ * Record size and arena of coroutine frame, to free it back to the arena
+ * @note Internal
+ */
+#	define __co_new_frame_mark(co, from_arena, fname)                                                                  \
+		((co)->size = sizeof(struct co_ctx_tname(fname)), (co)->arena = (from_arena))
+/**
+ * Arena of calling coroutine, its children are allocated from
+ * @note Internal
+ */
+#	define __co_self_arena(self) ((self)->obj.arena)
+#else
+#	define __co_new_frame_from(wq, alloc, arena, fname) __co_new_frame(wq, alloc, fname)
+#	define __co_new_frame_mark(co, from_arena, fname) ((void)0)
+#	define __co_self_arena(self) NULL
+#endif
+
 /**
  * Create and initialize coroutine obj
  * @param wq Corotine work queue
  * @param alloc Fast or slow allocator
+ * @param from_arena Arena to allocate from instead, or NULL, always NULL without CO_MULTI_CO_WQ_ARENA
  * @param fname Coroutine name
  * @param ... Coroutine arguments
  * @note Internal
  */
-#define __co_new(wq, alloc, fname, ...)                                                                                \
+#define __co_new(wq, alloc, from_arena, fname, ...)                                                                    \
 	({                                                                                                                 \
-		struct co_ctx_tname(fname) *__co_new_obj =                                                                     \
-			co_multi_co_wq_alloc(wq, alloc, sizeof(struct co_ctx_tname(fname)));                                       \
+		struct co_ctx_tname(fname) *__co_new_obj = __co_new_frame_from(wq, alloc, from_arena, fname);                  \
 		if (__co_new_obj) {                                                                                            \
-			co_routine_flag_set_alloc(&__co_new_obj->obj.flags, alloc);                                                \
 			*__co_new_obj = co_routine_ctx_init(fname, wq, ##__VA_ARGS__);                                             \
+			co_routine_flag_set_alloc(&__co_new_obj->obj.flags, alloc);                                                \
+			co_routine_flags_set_pool(&__co_new_obj->obj.flags, co_pool_fname(fname)());                               \
+			__co_new_frame_mark(&__co_new_obj->obj, from_arena, fname);                                                \
 		}                                                                                                              \
 		__co_new_obj;                                                                                                  \
 	})
 
+/**
+ * Set priority level of coroutine, effective from the next time it is queued to run
+ * Execq runs higher levels first, lower ones get to run once in a while as they age.
+ * Level is kept when coroutine is scheduled from another thread, through the input queue.
+ * @param target Coroutine object pointer
+ * @param level Priority level, 0 is the highest, below CO_MULTI_CO_WQ_PRIOS
+ */
+#define co_set_prio(target, level)                                                                                     \
+	({                                                                                                                 \
+		co_assert((level) < CO_MULTI_CO_WQ_PRIOS);                                                                     \
+		co_coroutine_obj_set_prio(&(target)->obj, (level));                                                            \
+	})
+
 /**
  * Create and initialize coroutine obj from other coroutine context
+ * Children of a coroutine allocated from an arena are allocated from the same arena.
+ * Child inherits priority level and deadline of the caller.
+ * Child is cancelled along with the caller, as long as both run, see co_cancel.
+ * @param self Calling coroutine
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#define co_fork(self, fname, ...)                                                                                      \
+	({                                                                                                                 \
+		struct co_ctx_tname(fname) *__co_child =                                                                       \
+			__co_new((self)->obj.wq, fast, __co_self_arena(self), fname, ##__VA_ARGS__);                               \
+		if (__co_child)                                                                                                \
+			co_coroutine_obj_inherit(&__co_child->obj, &(self)->obj);                                                  \
+		__co_child;                                                                                                    \
+	})
+
+/**
+ * Create and initialize coroutine obj from other coroutine context, at given priority level
  * @param self Calling coroutine
+ * @param level Priority level, see co_set_prio
  * @param fname Target coroutine name
  * @param ... Coroutine arguments
  */
-#define co_fork(self, fname, ...) __co_new((self)->obj.wq, fast, fname, ##__VA_ARGS__)
+#define co_fork_prio(self, level, fname, ...)                                                                          \
+	({                                                                                                                 \
+		struct co_ctx_tname(fname) *__co_fork_prio = co_fork(self, fname, ##__VA_ARGS__);                              \
+		if (__co_fork_prio)                                                                                            \
+			co_set_prio(__co_fork_prio, level);                                                                        \
+		__co_fork_prio;                                                                                                \
+	})
 
 /**
  * Create and initialize coroutine obj from other coroutine context, then run it
@@ -104,7 +181,143 @@
  * @param fname Target coroutine name
  * @param ... Coroutine arguments
  */
-#define co_new(wq, fname, ...) __co_new(wq, slow, fname, ##__VA_ARGS__)
+#define co_new(wq, fname, ...) __co_new(wq, slow, NULL, fname, ##__VA_ARGS__)
+
+/**
+ * Create and initialize coroutine obj from outside of the coroutine context, at given priority level
+ * @param wq Coroutine work queue to schedule on
+ * @param level Priority level, see co_set_prio
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#define co_new_prio(wq, level, fname, ...)                                                                             \
+	({                                                                                                                 \
+		struct co_ctx_tname(fname) *__co_new_prio = co_new(wq, fname, ##__VA_ARGS__);                                  \
+		if (__co_new_prio)                                                                                             \
+			co_set_prio(__co_new_prio, level);                                                                         \
+		__co_new_prio;                                                                                                 \
+	})
+
+#ifdef CO_MULTI_CO_WQ_EDF
+/**
+ * Set deadline of coroutine, effective from the next time it is queued to run
+ * Coroutines with a deadline run earliest deadline first, ahead of all priority levels, which
+ * still get to run once in a while as they age. One that terminates past its deadline counts
+ * as a deadline miss of its work queue, unless its parent still runs.
+ * @param target Coroutine object pointer
+ * @param abstime Absolute deadline, co_abstime_t, invalid to clear
+ */
+#	define co_set_deadline(target, abstime) ((target)->obj.deadline = (abstime))
+
+/**
+ * Create and initialize coroutine obj from other coroutine context, with given deadline
+ * @param self Calling coroutine
+ * @param abstime Absolute deadline, see co_set_deadline
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#	define co_fork_deadline(self, abstime, fname, ...)                                                                 \
+		({                                                                                                             \
+			struct co_ctx_tname(fname) *__co_fork_deadline = co_fork(self, fname, ##__VA_ARGS__);                      \
+			if (__co_fork_deadline)                                                                                    \
+				co_set_deadline(__co_fork_deadline, abstime);                                                          \
+			__co_fork_deadline;                                                                                        \
+		})
+
+/**
+ * Create and initialize coroutine obj from outside of the coroutine context, with given deadline
+ * @param wq Coroutine work queue to schedule on
+ * @param abstime Absolute deadline, see co_set_deadline
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#	define co_new_deadline(wq, abstime, fname, ...)                                                                    \
+		({                                                                                                             \
+			struct co_ctx_tname(fname) *__co_new_deadline = co_new(wq, fname, ##__VA_ARGS__);                          \
+			if (__co_new_deadline)                                                                                     \
+				co_set_deadline(__co_new_deadline, abstime);                                                           \
+			__co_new_deadline;                                                                                         \
+		})
+#endif
+
+#ifdef CO_MULTI_CO_WQ_ARENA
+/**
+ * Size of arena chunks, for a root coroutine, and given room for its descendants
+ * @note Internal
+ */
+#	define __co_new_arena_chunk(fname, size)                                                                           \
+		(sizeof(co_arena_chunk_t) + sizeof(co_arena_t) + __co_arena_round(sizeof(struct co_ctx_tname(fname))) + (size))
+
+/**
+ * Create and initialize coroutine obj that owns an arena, from outside of the coroutine context
+ * All its descendants created by co_fork are bump allocated from the arena, which is released
+ * in one step, once the coroutine and all of them are freed. No descendant can outlive it, as the
+ * arena stays as long as any of them does. While the coroutine has no live descendants, the arena
+ * is rewound, so a long running one does not make it grow forever. Needs CO_MULTI_CO_WQ_ARENA.
+ * @param wq Coroutine work queue to schedule on
+ * @param size Room for descendants per arena chunk, in bytes, arena grows by chunks when it runs out
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#	define co_new_arena(wq, size, fname, ...)                                                                          \
+		({                                                                                                             \
+			co_arena_t *__co_arena = co_arena_create((wq)->slow_alloc, __co_new_arena_chunk(fname, size));             \
+			struct co_ctx_tname(fname) *__co_arena_root = NULL;                                                        \
+			if (__co_arena && (__co_arena_root = __co_new(wq, slow, __co_arena, fname, ##__VA_ARGS__)) != NULL)        \
+				co_arena_set_owner(__co_arena, __co_arena_root);                                                       \
+			else if (__co_arena)                                                                                       \
+				co_arena_destroy(__co_arena);                                                                          \
+			__co_arena_root;                                                                                           \
+		})
+#endif
+
+/**
+ * Initialize coroutine obj in storage owned by the caller, no allocation involved
+ * Work queue never frees such a coroutine. Storage, typically a field of args or locals of the
+ * owner, must outlive it: owner must await it to termination, or terminate it, before it terminates
+ * itself. It must not be parked at that time. Once terminated it can be initialized again right away.
+ * @param wq Coroutine work queue to schedule on
+ * @param target Pointer to storage, of coroutine type
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#define co_init_inplace(wq, target, fname, ...)                                                                        \
+	({                                                                                                                 \
+		struct co_ctx_tname(fname) *__co_inplace = (target);                                                           \
+		*__co_inplace = co_routine_ctx_init(fname, wq, ##__VA_ARGS__);                                                 \
+		co_routine_flag_set(&__co_inplace->obj.flags, CO_FLAG_INPLACE);                                                \
+		__co_new_frame_mark(&__co_inplace->obj, NULL, fname);                                                          \
+		__co_inplace;                                                                                                  \
+	})
+
+/**
+ * Initialize coroutine obj in storage owned by calling coroutine, see co_init_inplace
+ * Child inherits priority level and deadline of the caller.
+ * Child is cancelled along with the caller, whose cancellation handler must then await it.
+ * @param self Calling coroutine
+ * @param target Pointer to storage, of coroutine type
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#define co_fork_inplace(self, target, fname, ...)                                                                      \
+	({                                                                                                                 \
+		struct co_ctx_tname(fname) *__co_child = co_init_inplace((self)->obj.wq, target, fname, ##__VA_ARGS__);        \
+		co_coroutine_obj_inherit(&__co_child->obj, &(self)->obj);                                                      \
+		__co_child;                                                                                                    \
+	})
+
+/**
+ * Initialize coroutine obj in storage owned by calling coroutine, then run it
+ * @param self Calling coroutine
+ * @param target Pointer to storage, of coroutine type
+ * @param fname Target coroutine name
+ * @param ... Coroutine arguments
+ */
+#define co_fork_run_inplace(self, target, fname, ...)                                                                  \
+	({                                                                                                                 \
+		struct co_ctx_tname(fname) *__co_fork_inplace = co_fork_inplace(self, target, fname, ##__VA_ARGS__);           \
+		co_run(self, __co_fork_inplace);                                                                               \
+	})
 
 /**
  * Schedule coroutine to start or continue running
@@ -114,18 +327,49 @@
 #define co_run(self, target)                                                                                           \
 	({                                                                                                                 \
 		co_assert((self) && (target) && (self)->obj.wq == (target)->obj.wq);                                           \
-		co_q_enq(&(self)->obj.wq->execq, &(target)->obj.qe);                                                           \
+		if (!co_coroutine_obj_unpause(&(target)->obj)) /* Paused, but not dropped yet, still queued */                 \
+			co_multi_co_wq_enq((self)->obj.wq, &(target)->obj);                                                        \
 		target;                                                                                                        \
 	})
 
 /**
- * Extract coroutine out of execution queue
+ * Take coroutine out of execution, until co_run
+ * O(1): coroutine is only marked, and the loop drops it the next time it would run it, when it reaches it
+ * in execq, or once it is woken up if it is parked, sleeping or awaiting. co_run before that only takes
+ * the mark off, after that queues it again.
  * @param self Coroutine self pointer
- * @param target Coroutine object pointer to pause
+ * @param target Coroutine object pointer to pause, must have been scheduled, co_run would not queue a
+ *               paused one that never was
  */
 #define co_pause(self, target)                                                                                         \
 	co_assert((self)->obj.wq == (target)->obj.wq);                                                                     \
-	co_q_cherry_pick(&(self)->obj.wq->execq, &(target)->obj.qe)
+	co_coroutine_obj_pause(&(target)->obj)
+
+#ifdef CO_MULTI_CO_WQ_CANCEL
+/**
+ * Cancel coroutine, and all its descendants, see co_multi_co_wq_cancel
+ * Those awaiting it are woken up once it terminates, and tell it by co_is_cancelled. Needs CO_MULTI_CO_WQ_CANCEL.
+ * @param self Coroutine self pointer
+ * @param target Coroutine object pointer to cancel, may be self
+ */
+#	define co_cancel(self, target)                                                                                     \
+		co_assert((self)->obj.wq == (target)->obj.wq);                                                                 \
+		co_multi_co_wq_cancel((self)->obj.wq, &(target)->obj)
+
+/**
+ * Cancellation handler, the block that follows it
+ * Once the statement is passed, a cancelled coroutine resumes in the block instead of where it yielded,
+ * and terminates at its end. The block may yield, such as to await children, but not break out of itself.
+ * A later handler replaces an earlier one. Until the first one is passed, a cancelled coroutine simply
+ * terminates.
+ * @param self Coroutine self pointer
+ */
+#	define co_on_cancel(self)                                                                                          \
+		(self)->obj.cancel_ip = &&co_label_checkpoint_cancel - &&__co_label_start;                                     \
+		if (0)                                                                                                         \
+		co_label_checkpoint_cancel:                                                                                    \
+			for (;; ({ return CO_RV_YIELD_BREAK; }))
+#endif
 
 /**
  * Schedule coroutine to start, from external context
@@ -134,8 +378,7 @@
  */
 #define co_schedule(_wq, target)                                                                                       \
 	co_assert(_wq == (target)->obj.wq);                                                                                \
-	co_multi_src_q_enq(&(_wq)->inputq, &(target)->obj.qe);                                                             \
-	co_multi_co_wq_ring_the_bell(_wq)
+	co_multi_co_wq_wake(_wq, &(target)->obj)
 
 /**
  * Terminate coroutine execution
@@ -155,6 +398,98 @@
 co_label_checkpoint_await:                                                                                             \
 	__co_nop();
 
+/**
+ * Call other coroutine synchronously, awaiting it only if it suspends
+ * Child runs right away, as a plain function call. If it returns or breaks on this first run,
+ * caller goes on without yielding, otherwise it awaits the child, as co_yield_await.
+ * @param self Coroutine self pointer
+ * @param target Coroutine object pointer to call, created by co_fork and not run yet
+ */
+#define co_yield_call(self, target)                                                                                    \
+	if (!co_multi_co_wq_call((self)->obj.wq, &(target)->obj)) {                                                        \
+		co_yield_await(self, target);                                                                                  \
+	}
+
+#ifdef CO_MULTI_CO_WQ_GROUPS
+/**
+ * Arm await group on children
+ * Children terminated already count as done, the first of them as the first to terminate.
+ * @note Internal
+ */
+#	define __co_await_group_arm(self, grp, n, children)                                                                \
+		({                                                                                                             \
+			co_await_group_t *__co_group = (grp);                                                                      \
+			co_size_t __co_i;                                                                                          \
+			__co_group->parent  = &(self)->obj;                                                                        \
+			__co_group->pending = 0;                                                                                   \
+			__co_group->first   = NULL;                                                                                \
+			for (__co_i = 0; __co_i < (n); ++__co_i) {                                                                 \
+				co_coroutine_obj_t *__co_child = &(children)[__co_i]->obj;                                             \
+				if (!co_is_terminated(__co_child)) {                                                                   \
+					__co_child->group = __co_group;                                                                    \
+					++__co_group->pending;                                                                             \
+				} else if (!__co_group->first) {                                                                       \
+					__co_group->first = __co_child;                                                                    \
+				}                                                                                                      \
+			}                                                                                                          \
+			__co_group;                                                                                                \
+		})
+
+/**
+ * Await several children at once, resuming once, when the last of them terminates
+ * Each child counts down the group when it terminates, instead of rescheduling the caller.
+ * Children must be alive: forked since the caller last yielded, or in place. They are freed as usual
+ * as they terminate, so once woken up the caller must not look at them, other than comparing pointers:
+ * results are to be taken from in place children, or passed out through args. Needs CO_MULTI_CO_WQ_GROUPS.
+ * @param self Coroutine self pointer
+ * @param grp Await group pointer, in args or locals of caller, must outlive children
+ * @param n Number of children, re-evaluated after yield
+ * @param children Array of children coroutine object pointers, re-evaluated after yield
+ */
+#	define co_yield_await_all(self, grp, n, children)                                                                  \
+		if (__co_await_group_arm(self, grp, n, children)->pending) {                                                   \
+			(grp)->wake_at = 0;                                                                                        \
+			(self)->obj.ip   = &&co_label_checkpoint_await - &&__co_label_start;                                       \
+			return CO_RV_YIELD_AWAIT;                                                                                  \
+		}                                                                                                              \
+	co_label_checkpoint_await:                                                                                         \
+		__co_nop();
+
+/**
+ * Await several children at once, resuming once, when the first of them terminates
+ * Same rules as co_yield_await_all. Others go on running and still count down the group, so the
+ * caller must terminate them, or await them with co_yield_await_rest, before the group goes away.
+ * @param self Coroutine self pointer
+ * @param grp Await group pointer, in args or locals of caller, must outlive children
+ * @param n Number of children, re-evaluated after yield
+ * @param children Array of children coroutine object pointers, re-evaluated after yield
+ * @param index Lvalue set to index of the first child to terminate, n if there are no children
+ */
+#	define co_yield_await_any(self, grp, n, children, index)                                                           \
+		if (!__co_await_group_arm(self, grp, n, children)->first && (grp)->pending) {                                  \
+			(grp)->wake_at = (grp)->pending - 1;                                                                       \
+			(self)->obj.ip   = &&co_label_checkpoint_await - &&__co_label_start;                                       \
+			return CO_RV_YIELD_AWAIT;                                                                                  \
+		}                                                                                                              \
+	co_label_checkpoint_await:                                                                                         \
+		for ((index) = 0; (index) < (n) && &(children)[index]->obj != (grp)->first; ++(index))                         \
+			;
+
+/**
+ * Await children of group still running, after co_yield_await_any
+ * @param self Coroutine self pointer
+ * @param grp Await group pointer
+ */
+#	define co_yield_await_rest(self, grp)                                                                              \
+		if ((grp)->pending) {                                                                                          \
+			(grp)->wake_at = 0;                                                                                        \
+			(self)->obj.ip   = &&co_label_checkpoint_await - &&__co_label_start;                                       \
+			return CO_RV_YIELD_AWAIT;                                                                                  \
+		}                                                                                                              \
+	co_label_checkpoint_await:                                                                                         \
+		__co_nop();
+#endif
+
 /**
  * Await for next response of previously invoked coroutine
  * @param self Coroutine self pointer
@@ -206,6 +541,69 @@ co_label_checkpoint_await:
 		co_run(self, target);                                                                                          \
 	}
 
+/**
+ * Batch of values, return type of a batched generator
+ * Generator fills it up and yields it once full, rather than yielding each value on its own.
+ * Storage of values belongs to the caller, see co_batch_bind.
+ * @param type Value type
+ */
+#define co_batch_t(type)                                                                                               \
+	struct {                                                                                                           \
+		type *items;                                                                                                   \
+		co_size_t count;                                                                                               \
+		co_size_t cap;                                                                                                 \
+	}
+
+/**
+ * Give batched generator storage to fill, before it runs
+ * @param target Batched generator coroutine object pointer
+ * @param buf Array of values
+ * @param n Number of values in array
+ */
+#define co_batch_bind(target, buf, n) ((target)->rv.items = (buf), (target)->rv.cap = (n), (target)->rv.count = 0)
+
+/**
+ * Item of batch yielded by batched generator
+ * @param target Batched generator coroutine object pointer
+ * @param i Index, below (target)->rv.count
+ */
+#define co_batch_item(target, i) ((target)->rv.items[i])
+
+/**
+ * Awaits batched generator and walks each batch it yields, while it is alive
+ * Generator runs again only after the caller yields, even at a higher level, so the batch stays valid until
+ * then and the body must not yield. Break leaves the current batch only.
+ * @param self Calling coroutine
+ * @param target Batched generator coroutine object pointer
+ * @param i Index lvalue, see co_batch_item
+ */
+#define for_each_yield_batch(self, target, i)                                                                          \
+	while_co_yield_await(self, target)                                                                                 \
+		for ((i) = 0; (i) < (target)->rv.count; ++(i))
+
+/**
+ * Add value to batch of batched generator, yielding the batch once it is full
+ * @param self Calling coroutine, of co_batch_t return type
+ * @param value Value to add
+ */
+#define co_yield_batch(self, value)                                                                                    \
+	(self)->rv.items[(self)->rv.count++] = (value);                                                                    \
+	if ((self)->rv.count == (self)->rv.cap) {                                                                          \
+		co_yield_return(self);                                                                                         \
+		(self)->rv.count = 0;                                                                                          \
+	}
+
+/**
+ * Yield batch of batched generator, unless it is empty
+ * Values left in batch are lost when generator breaks, so it flushes first.
+ * @param self Calling coroutine, of co_batch_t return type
+ */
+#define co_yield_batch_flush(self)                                                                                     \
+	if ((self)->rv.count) {                                                                                            \
+		co_yield_return(self);                                                                                         \
+		(self)->rv.count = 0;                                                                                          \
+	}
+
 /**
  * Yield coroutine, returning a value
  * @param self Calling coroutine
@@ -228,8 +626,37 @@ co_label_checkpoint:
 	return CO_RV_YIELD_COND_WAIT;                                                                                      \
 co_label_checkpoint:
 
+/**
+ * Yield coroutine and leave it parked off execq
+ * Must be preceded by registering the coroutine on something that will reschedule it.
+ * @param self Calling coroutine
+ */
+#define co_yield_park(self)                                                                                            \
+	(self)->obj.ip = &&co_label_checkpoint - &&__co_label_start; /* Save return point */                               \
+	return CO_RV_YIELD_PARK;                                                                                           \
+co_label_checkpoint:                                                                                                   \
+	__co_nop()
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+/**
+ * Yield coroutine and park it until file descriptor is ready
+ * Work queue loop watches the fd in its own epoll instance, no extra thread involved.
+ * One coroutine may wait to read and another one to write the same fd, see co_multi_co_wq_watch_fd.
+ * @param self Calling coroutine
+ * @param fd File descriptor
+ * @param events Epoll events to wait for, such as EPOLLIN or EPOLLOUT
+ * @note If fd cannot be watched, coroutine does not yield, and errno tells why
+ */
+#define co_yield_wait_fd(self, fd, events)                                                                             \
+	if ((errno = co_multi_co_wq_watch_fd((self)->obj.wq, &(self)->obj, fd, events)) == 0) {                            \
+		co_yield_park(self);                                                                                           \
+	}
+#endif
+
 /**
  * Yield coroutine and send it to sleep until a condition is fulfilled
+ * Coroutine is re-run on every pass of the work queue to re-test the condition.
+ * If whoever fulfills the condition can tell it, prefer parking on co_waitq_t.
  * @param self Calling coroutine
  * @param cond Condition to wait for
  */
@@ -239,14 +666,16 @@ co_label_checkpoint:
 		return CO_RV_YIELD_COND_WAIT;
 
 /**
- * Yield coroutine and send it to sleep indefinitely until external wake up event
+ * Yield coroutine and park it until external wake up event
+ * Wake up is done by co_coroutine_obj_ring_the_bell, from any thread.
  * @param self Calling coroutine
- * @param ... Optional return value
  */
 #define co_yield_wait_ready(self)                                                                                      \
 	{                                                                                                                  \
-		co_routine_flag_clear(&(self)->obj.flags, CO_FLAG_READY);                                                      \
-		co_yield_wait_cond(self, co_routine_flag_test((self)->obj.flags, CO_FLAG_READY))                               \
+		co_routine_flag_clear_atomic(&(self)->obj.flags, CO_FLAG_READY);                                               \
+		if (co_coroutine_obj_park(&(self)->obj)) {                                                                     \
+			co_yield_park(self);                                                                                       \
+		}                                                                                                              \
 	}
 
 #define co_ctx_def(rtype, fname, ...)                                                                                  \
@@ -261,15 +690,43 @@ co_label_checkpoint:
 	}
 
 /**
- * Co routine declaration, must come before body
+ * Co routine declaration, without frame pool
+ * @note Internal
  */
-#define co_routine_decl(rtype, fname, ...)                                                                             \
+#define __co_routine_decl(rtype, fname, ...)                                                                           \
 	co_ctx_def(rtype, fname, ##__VA_ARGS__); /* Define ctx */                                                          \
 	extern co_routine_body_proto(fname);     /* Declare body function */                                               \
 	static __inline__ co_yield_rv_t co_wrapper_fname(fname)(co_coroutine_obj_t * self) {                               \
 		return co_body_fname(fname)(co_ctx(self, fname));                                                              \
 	}
 
+/**
+ * Co routine declaration, must come before body
+ */
+#define co_routine_decl(rtype, fname, ...)                                                                             \
+	__co_routine_decl(rtype, fname, ##__VA_ARGS__);                                                                    \
+	static __inline__ unsigned co_pool_fname(fname)(void) { return 0; }
+
+/**
+ * Co routine declaration, with frame pool, must come before body
+ * Frames of coroutines forked on a work queue are kept in a pool of that work queue when they terminate,
+ * so that in steady state forking one takes no allocator call. Use for hot, short lived coroutine types.
+ * The type needs co_routine_define_pool in exactly one .c file, all translation units share its pool.
+ * The program needs co_multi_co_wq_define_pool_ids in exactly one .c file as well.
+ */
+#define co_routine_decl_pooled(rtype, fname, ...)                                                                      \
+	__co_routine_decl(rtype, fname, ##__VA_ARGS__);                                                                    \
+	extern unsigned co_pool_id_fname(fname);                                                                           \
+	static __inline__ unsigned co_pool_fname(fname)(void) {                                                            \
+		unsigned id = *(volatile unsigned *)&co_pool_id_fname(fname);                                                  \
+		return id != CO_MULTI_CO_WQ_POOL_UNSET ? id : co_multi_co_wq_pool_register(&co_pool_id_fname(fname));          \
+	}
+
+/**
+ * Frame pool id of a coroutine type declared with co_routine_decl_pooled, one per type in a .c file
+ */
+#define co_routine_define_pool(fname) unsigned co_pool_id_fname(fname) = CO_MULTI_CO_WQ_POOL_UNSET
+
 /**
  * Co-routine body prototype
  */
@@ -0,0 +1,396 @@
+#ifndef CO_IO_H
+#define CO_IO_H
+/**
+ * @file co_io.h
+ *
+ * Asynchronous I/O for coroutines
+ *
+ * Coroutine describes an operation in a request object, yields, and is parked
+ * until the operation completes. Result is then found in the request.
+ *
+ * Two backends:
+ *    io_uring - operations are batched into the submission queue while the work
+ *    queue runs, submitted with one system call per loop pass, and completions
+ *    are reaped in a batch too. Ring fd is watched by the epoll bell, so a
+ *    sleeping work queue wakes up on completions. Hence requires CO_MULTI_CO_WQ_EPOLL.
+ *
+ *    Helper threads - portable fallback. Operations are performed by blocking
+ *    system calls on a small thread pool, and coroutines are woken up through
+ *    the input queue of their work queue. Each pending operation holds a thread,
+ *    so the pool must be larger than the number of operations that may wait on
+ *    one another (e.g. both ends of a socket pair).
+ *
+ * One I/O object per work queue. Linux only.
+ *
+ */
+
+#include "co_coroutines.h"
+#include "co_multi_co_wq.h"
+#include "dep/co_dbg.h"
+#include "dep/co_list.h"
+#include "dep/co_thread_pool.h"
+#include "dep/co_types.h"
+#include <errno.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+#	include "dep/co_uring.h"
+#endif
+
+/**
+ * Operation codes
+ */
+typedef enum {
+	CO_IO_READ,
+	CO_IO_WRITE,
+	CO_IO_ACCEPT,
+	CO_IO_RECV,
+	CO_IO_SEND,
+} co_io_op_t;
+
+/**
+ * I/O request
+ * Must stay valid until completion, so it is normally kept in coroutine arguments or locals.
+ */
+typedef struct co_io_req {
+	/** Queue element, used by helper threads backend */
+	co_list_e_t qe;
+	/** Waiting coroutine */
+	co_coroutine_obj_t *co;
+	/** Result: number of bytes or accepted fd, negative error code on failure */
+	long res;
+	co_io_op_t op;
+	int fd;
+	void *buf;
+	co_size_t len;
+	/** Read/write file offset, -1 to use and advance current position */
+	off_t off;
+	/** accept4 or send/recv flags */
+	int flags;
+	struct sockaddr *addr;
+	socklen_t *addrlen;
+} co_io_req_t;
+
+/**
+ * I/O object
+ */
+typedef struct co_io {
+	/** Work queue interface, must be first */
+	co_multi_co_wq_io_t base;
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	/** Whether io_uring is used, else helper threads */
+	co_bool_t use_ring;
+	co_uring_t ring;
+#endif
+	co_thread_pool_t pool;
+} co_io_t;
+
+/**
+ * Perform request synchronously, on helper thread
+ * @note Internal
+ */
+static void __co_io_pool_work(co_list_e_t *job) {
+	co_io_req_t *req = __co_container_of(job, co_io_req_t, qe);
+	long rv          = -1;
+	switch (req->op) {
+		case CO_IO_READ:
+			rv = req->off < 0 ? read(req->fd, req->buf, req->len) : pread(req->fd, req->buf, req->len, req->off);
+			break;
+		case CO_IO_WRITE:
+			rv = req->off < 0 ? write(req->fd, req->buf, req->len) : pwrite(req->fd, req->buf, req->len, req->off);
+			break;
+		case CO_IO_ACCEPT:
+			rv = syscall(__NR_accept4, req->fd, req->addr, req->addrlen, req->flags); /* No _GNU_SOURCE needed */
+			break;
+		case CO_IO_RECV:
+			rv = recv(req->fd, req->buf, req->len, req->flags);
+			break;
+		case CO_IO_SEND:
+			rv = send(req->fd, req->buf, req->len, req->flags);
+			break;
+	}
+	req->res = rv < 0 ? -errno : rv;
+	co_multi_co_wq_wake(req->co->wq, req->co);
+}
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+/**
+ * Complete request of the ring and reschedule its coroutine
+ * @note Internal
+ */
+static __inline__ void __co_io_ring_complete(co_io_t *io, co_multi_co_wq_t *wq, co_io_req_t *req, long res) {
+	req->res = res;
+	co_multi_co_wq_enq(wq, req->co);
+	--io->base.inflight;
+}
+
+/**
+ * Reschedule coroutines of completed requests
+ * @return Number of coroutines rescheduled
+ * @note Internal
+ */
+static __inline__ co_size_t __co_io_ring_reap(co_io_t *io, co_multi_co_wq_t *wq) {
+	struct io_uring_cqe *cqe;
+	co_size_t n = 0;
+	while ((cqe = co_uring_peek_cqe(&io->ring)) != NULL) {
+		co_io_req_t *req = (co_io_req_t *)(uintptr_t)cqe->user_data;
+		long res         = cqe->res;
+		co_uring_cqe_seen(&io->ring);
+		__co_io_ring_complete(io, wq, req, res);
+		++n;
+	}
+	return n;
+}
+
+/**
+ * Submit pending entries, reaping completions first to make room for theirs
+ * On EAGAIN or EBUSY entries stay pending, to be submitted on the next loop pass, on other errors
+ * their requests fail with it.
+ * @param woken Incremented by number of coroutines rescheduled
+ * @return 0 or error code
+ * @note Internal
+ */
+static __inline__ co_errno_t __co_io_ring_flush(co_io_t *io, co_multi_co_wq_t *wq, co_size_t *woken) {
+	struct io_uring_sqe *sqe;
+	co_errno_t rv;
+	*woken += __co_io_ring_reap(io, wq);
+	if ((rv = co_uring_submit(&io->ring)) == 0 || rv == EAGAIN || rv == EBUSY)
+		return rv;
+	while ((sqe = co_uring_unget_sqe(&io->ring)) != NULL) {
+		__co_io_ring_complete(io, wq, (co_io_req_t *)(uintptr_t)sqe->user_data, -rv);
+		++*woken;
+	}
+	return rv;
+}
+
+/**
+ * Submit pending entries and reschedule coroutines of completed requests
+ * @note Internal
+ */
+static co_size_t __co_io_ring_poll(co_multi_co_wq_io_t *base, co_multi_co_wq_t *wq) {
+	co_io_t *io = (co_io_t *)base;
+	co_size_t n = 0;
+	__co_io_ring_flush(io, wq, &n);
+	return n + __co_io_ring_reap(io, wq);
+}
+
+/**
+ * Fill submission entry, flushing submission queue if it is full
+ * If it stays full, request fails right away, with the error of the flush.
+ * @note Internal
+ */
+static __inline__ void __co_io_ring_submit(co_io_t *io, co_multi_co_wq_t *wq, co_io_req_t *req) {
+	struct io_uring_sqe *sqe;
+	co_size_t woken = 0;
+	co_errno_t rv;
+	if ((sqe = co_uring_get_sqe(&io->ring)) == NULL) {
+		rv = __co_io_ring_flush(io, wq, &woken);
+		if ((sqe = co_uring_get_sqe(&io->ring)) == NULL) {
+			++io->base.inflight;
+			__co_io_ring_complete(io, wq, req, -rv); /* Coroutine is not parked yet, it runs once it is */
+			return;
+		}
+	}
+	sqe->fd        = req->fd;
+	sqe->addr      = (uintptr_t)req->buf;
+	sqe->len       = req->len;
+	sqe->user_data = (uintptr_t)req;
+	switch (req->op) {
+		case CO_IO_READ:
+		case CO_IO_WRITE:
+			sqe->opcode = req->op == CO_IO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+			sqe->off    = (__u64)(long long)req->off; /* -1 is current position */
+			break;
+		case CO_IO_ACCEPT:
+			sqe->opcode       = IORING_OP_ACCEPT;
+			sqe->addr         = (uintptr_t)req->addr;
+			sqe->addr2        = (uintptr_t)req->addrlen;
+			sqe->len          = 0;
+			sqe->accept_flags = req->flags;
+			break;
+		case CO_IO_RECV:
+		case CO_IO_SEND:
+			sqe->opcode    = req->op == CO_IO_RECV ? IORING_OP_RECV : IORING_OP_SEND;
+			sqe->msg_flags = req->flags;
+			break;
+	}
+	++io->base.inflight;
+}
+#endif
+
+/**
+ * Initialize I/O object and attach it to work queue
+ * @param io I/O object pointer
+ * @param wq Work queue to serve
+ * @param ring_entries Size of io_uring submission queue, 0 to always use helper threads
+ * @param pool_threads Number of helper threads, used when io_uring is not available
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_io_init(co_io_t *io, co_multi_co_wq_t *wq, unsigned ring_entries,
+                                        co_size_t pool_threads) {
+	co_errno_t rv;
+	io->base.inflight = 0;
+	io->base.fd       = -1;
+	io->base.poll     = NULL;
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	io->use_ring = ring_entries && !co_uring_init(&io->ring, ring_entries);
+	if (io->use_ring) {
+		io->base.fd   = io->ring.fd;
+		io->base.poll = __co_io_ring_poll;
+		if ((rv = co_multi_co_wq_attach_io(wq, &io->base)) != 0)
+			co_uring_destroy(&io->ring);
+		return rv;
+	}
+	co_dbg_trace("io_uring is not available, falling back to helper threads\n");
+#else
+	(void)ring_entries;
+#endif
+	if ((rv = co_thread_pool_init(&io->pool, pool_threads, __co_io_pool_work)) != 0)
+		return rv;
+	if ((rv = co_multi_co_wq_attach_io(wq, &io->base)) != 0)
+		co_thread_pool_destroy(&io->pool);
+	return rv;
+}
+
+/**
+ * Detach I/O object from work queue and destroy it
+ * Work queue must not be running. Requests still pending are either completed
+ * (helper threads) or abandoned (io_uring).
+ * @param io I/O object pointer
+ * @param wq Work queue it was initialized with
+ */
+static __inline__ void co_io_destroy(co_io_t *io, co_multi_co_wq_t *wq) {
+	co_multi_co_wq_detach_io(wq);
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	if (io->use_ring) {
+		co_uring_destroy(&io->ring);
+		return;
+	}
+#endif
+	co_thread_pool_destroy(&io->pool);
+}
+
+/**
+ * Start request on behalf of coroutine, which must park right after
+ * @param wq Work queue of coroutine, with I/O object attached
+ * @param co Coroutine
+ * @param req Prepared request
+ */
+static __inline__ void co_io_submit(co_multi_co_wq_t *wq, co_coroutine_obj_t *co, co_io_req_t *req) {
+	co_io_t *io = (co_io_t *)wq->io;
+	co_assert(io, "Work queue has no I/O object attached\n");
+	req->co = co;
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	if (io->use_ring) {
+		__co_io_ring_submit(io, wq, req);
+		return;
+	}
+#endif
+	co_thread_pool_push(&io->pool, &req->qe);
+}
+
+/**
+ * Fill request
+ * @note Internal
+ */
+#define __co_io_prep(req, _op, _fd, _buf, _len, _off, _flags, _addr, _addrlen)                                         \
+	{                                                                                                                  \
+		(req)->op      = (_op);                                                                                        \
+		(req)->fd      = (_fd);                                                                                        \
+		(req)->buf     = (_buf);                                                                                       \
+		(req)->len     = (_len);                                                                                       \
+		(req)->off     = (_off);                                                                                       \
+		(req)->flags   = (_flags);                                                                                     \
+		(req)->addr    = (_addr);                                                                                      \
+		(req)->addrlen = (_addrlen);                                                                                   \
+	}
+
+/**
+ * Yield coroutine until request completes
+ * @note Internal
+ */
+#define __co_yield_io(self, req)                                                                                       \
+	{                                                                                                                  \
+		co_io_submit((self)->obj.wq, &(self)->obj, req);                                                               \
+		co_yield_park(self);                                                                                           \
+	}
+
+/**
+ * Yield coroutine until read completes
+ * @param self Calling coroutine
+ * @param req Request object, result is in req->res
+ * @param fd File descriptor
+ * @param buf Buffer
+ * @param len Buffer size
+ * @param off File offset, -1 to use current position
+ */
+#define co_yield_read(self, req, fd, buf, len, off)                                                                    \
+	{                                                                                                                  \
+		__co_io_prep(req, CO_IO_READ, fd, buf, len, off, 0, NULL, NULL);                                               \
+		__co_yield_io(self, req);                                                                                      \
+	}
+
+/**
+ * Yield coroutine until write completes
+ * @param self Calling coroutine
+ * @param req Request object, result is in req->res
+ * @param fd File descriptor
+ * @param buf Buffer
+ * @param len Number of bytes to write
+ * @param off File offset, -1 to use current position
+ */
+#define co_yield_write(self, req, fd, buf, len, off)                                                                   \
+	{                                                                                                                  \
+		__co_io_prep(req, CO_IO_WRITE, fd, buf, len, off, 0, NULL, NULL);                                              \
+		__co_yield_io(self, req);                                                                                      \
+	}
+
+/**
+ * Yield coroutine until a connection is accepted
+ * @param self Calling coroutine
+ * @param req Request object, accepted fd is in req->res
+ * @param fd Listening socket
+ * @param addr Peer address output, may be NULL
+ * @param addrlen Peer address size in/out, may be NULL
+ */
+#define co_yield_accept(self, req, fd, addr, addrlen)                                                                  \
+	{                                                                                                                  \
+		__co_io_prep(req, CO_IO_ACCEPT, fd, NULL, 0, 0, 0, addr, addrlen);                                             \
+		__co_yield_io(self, req);                                                                                      \
+	}
+
+/**
+ * Yield coroutine until data is received from socket
+ * @param self Calling coroutine
+ * @param req Request object, result is in req->res
+ * @param fd Socket
+ * @param buf Buffer
+ * @param len Buffer size
+ * @param flags recv flags
+ */
+#define co_yield_recv(self, req, fd, buf, len, flags)                                                                  \
+	{                                                                                                                  \
+		__co_io_prep(req, CO_IO_RECV, fd, buf, len, 0, flags, NULL, NULL);                                             \
+		__co_yield_io(self, req);                                                                                      \
+	}
+
+/**
+ * Yield coroutine until data is sent to socket
+ * @param self Calling coroutine
+ * @param req Request object, result is in req->res
+ * @param fd Socket
+ * @param buf Data
+ * @param len Number of bytes to send
+ * @param flags send flags
+ */
+#define co_yield_send(self, req, fd, buf, len, flags)                                                                  \
+	{                                                                                                                  \
+		__co_io_prep(req, CO_IO_SEND, fd, buf, len, 0, flags, NULL, NULL);                                             \
+		__co_yield_io(self, req);                                                                                      \
+	}
+
+#endif /*CO_IO_H*/
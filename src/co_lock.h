@@ -0,0 +1,311 @@
+#ifndef CO_LOCK_H
+#define CO_LOCK_H
+/**
+ * @file co_lock.h
+ *
+ * Locks for coroutines: semaphore, mutex and readers-writer lock
+ *
+ * A coroutine that cannot take a lock is parked, off execq, instead of spinning on
+ * co_yield_wait_cond, or blocking the whole work queue thread. Lock holders may yield
+ * while holding, and may live on any work queue.
+ *
+ * Uncontended lock and unlock are a single atomic operation. Contenders are parked
+ * in FIFO order, and an unlock that finds one hands the lock over directly: the waiter
+ * is woken up owning it, and newcomers cannot barge in meanwhile.
+ *
+ * A semaphore contender that counted itself in, but did not get to link itself to the
+ * wait queue yet, may be missed by a release. Such release leaves a hand off token behind,
+ * under the wait queue lock, and the contender takes it instead of parking. Readers-writer
+ * lock contenders queue themselves under its lock instead, as they have two queues to choose from.
+ *
+ */
+
+#include "co_coroutines.h"
+#include "co_waitq.h"
+#include "dep/co_atomics.h"
+#include "dep/co_list.h"
+#include "dep/co_sync.h"
+#include "dep/co_types.h"
+
+/**
+ * Take hand off token, if any, wait queue lock held
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_lock_take_handoff(co_size_t *handoff) {
+	if (!*handoff)
+		return 0;
+	--*handoff;
+	return 1;
+}
+
+/**
+ * Hand lock over to the first waiter, or leave a token to the one about to wait
+ * @note Internal
+ */
+static __inline__ void __co_lock_pass(co_multi_co_wq_t *wq, co_waitq_t *waitq, co_size_t *handoff) {
+	co_list_e_t *e;
+	co_spin_lock(&waitq->lock);
+	if ((e = co_q_peek(&waitq->q)) != NULL)
+		co_q_deq(&waitq->q);
+	else
+		++*handoff;
+	co_spin_unlock(&waitq->lock);
+	if (e)
+		__co_waitq_resume(wq, __co_container_of(e, co_coroutine_obj_t, qe));
+}
+
+/**
+ * Semaphore, coroutine flavour of co_sem_t
+ */
+typedef struct co_semaphore {
+	/** Permits available, minus contenders when negative */
+	co_atom_t count;
+	/** Hand off tokens, guarded by waiters lock */
+	co_size_t handoff;
+	/** Parked contenders */
+	co_waitq_t waiters;
+} co_semaphore_t;
+
+/**
+ * Initializer of semaphore
+ * @param permits Number of permits
+ */
+#define co_semaphore_init(permits)                                                                                     \
+	(co_semaphore_t) { co_atom_init(permits), 0, co_waitq_init() }
+
+/**
+ * Take a permit, unless there is none
+ * @param sem Semaphore pointer
+ * @return 1 if taken, else 0
+ */
+static __inline__ co_bool_t co_semaphore_try_acquire(co_semaphore_t *sem) {
+	int count;
+	while ((count = co_atom_peek(&sem->count)) > 0)
+		if (co_atom_cmpxchg(&sem->count, count, count - 1) == count)
+			return 1;
+	return 0;
+}
+
+/**
+ * Give a permit back, handing it over to the first contender if any
+ * @param wq Work queue of the caller
+ * @param sem Semaphore pointer
+ * @note Internal, see co_release
+ */
+static __inline__ void __co_semaphore_release(co_multi_co_wq_t *wq, co_semaphore_t *sem) {
+	if (co_atom_add(&sem->count, 1) <= 0)
+		__co_lock_pass(wq, &sem->waiters, &sem->handoff);
+}
+
+/**
+ * Take a permit, yield and park coroutine until one is handed over if there is none
+ * @param self Calling coroutine
+ * @param sem Semaphore pointer
+ */
+#define co_yield_acquire(self, sem)                                                                                    \
+	if (co_atom_sub(&(sem)->count, 1) < 0 &&                                                                           \
+	    __co_waitq_park_unless(&(sem)->waiters, &(self)->obj, __co_lock_take_handoff(&(sem)->handoff))) {              \
+		co_yield_park(self); /* Woken up owning the permit */                                                          \
+	}
+
+/**
+ * Give a permit back
+ * @param self Calling coroutine
+ * @param sem Semaphore pointer
+ */
+#define co_release(self, sem) __co_semaphore_release((self)->obj.wq, sem)
+
+/**
+ * Mutex, a semaphore of a single permit
+ */
+typedef struct co_mutex {
+	co_semaphore_t sem;
+} co_mutex_t;
+
+/**
+ * Initializer of mutex, unlocked
+ */
+#define co_mutex_init()                                                                                                \
+	(co_mutex_t) { co_semaphore_init(1) }
+
+/**
+ * Lock mutex, unless it is locked
+ * @param m Mutex pointer
+ * @return 1 if locked, else 0
+ */
+static __inline__ co_bool_t co_mutex_try_lock(co_mutex_t *m) { return co_atom_cmpxchg(&m->sem.count, 1, 0) == 1; }
+
+/**
+ * Lock mutex, yield and park coroutine until it is handed over if it is locked
+ * @param self Calling coroutine
+ * @param m Mutex pointer
+ */
+#define co_yield_lock(self, m) co_yield_acquire(self, &(m)->sem)
+
+/**
+ * Unlock mutex
+ * @param self Calling coroutine
+ * @param m Mutex pointer
+ */
+#define co_unlock(self, m) co_release(self, &(m)->sem)
+
+/** Readers-writer lock state: writer holds */
+#define CO_RWLOCK_WRITER (1)
+/** Readers-writer lock state: someone is parked, fast paths closed */
+#define CO_RWLOCK_QUEUED (2)
+/** Readers-writer lock state: one reader holds, readers count above flags */
+#define CO_RWLOCK_READER (4)
+
+/**
+ * Readers-writer lock
+ * Contenders wait in FIFO order within readers and within writers. Once a writer waits,
+ * new readers wait too. Writer unlock hands over to all waiting readers first, last
+ * reader unlock to the first waiting writer, so neither side starves.
+ */
+typedef struct co_rwlock {
+	/** Readers count and flags, see CO_RWLOCK_WRITER */
+	co_atom_t state;
+	/** Guards the wait queues, and the state while queued flag is set */
+	co_atom_t lock;
+	/** Parked readers */
+	co_queue_t readers;
+	/** Parked writers */
+	co_queue_t writers;
+} co_rwlock_t;
+
+/**
+ * Initializer of readers-writer lock, unlocked
+ */
+#define co_rwlock_init()                                                                                               \
+	(co_rwlock_t) { co_atom_init(0), co_atom_init(0), co_q_init(), co_q_init() }
+
+/**
+ * Lock for reading, unless a writer holds or waits
+ * @param rw Readers-writer lock pointer
+ * @return 1 if locked, else 0
+ */
+static __inline__ co_bool_t co_rwlock_try_rdlock(co_rwlock_t *rw) {
+	int state;
+	while (!((state = co_atom_peek(&rw->state)) & (CO_RWLOCK_WRITER | CO_RWLOCK_QUEUED)))
+		if (co_atom_cmpxchg(&rw->state, state, state + CO_RWLOCK_READER) == state)
+			return 1;
+	return 0;
+}
+
+/**
+ * Lock for writing, unless anyone holds or waits
+ * @param rw Readers-writer lock pointer
+ * @return 1 if locked, else 0
+ */
+static __inline__ co_bool_t co_rwlock_try_wrlock(co_rwlock_t *rw) {
+	return co_atom_cmpxchg(&rw->state, 0, CO_RWLOCK_WRITER) == 0;
+}
+
+/**
+ * Lock, or queue coroutine to be handed the lock over, under the wait queues lock
+ * @return 1 if queued, 0 if locked
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_rwlock_lock_or_queue(co_rwlock_t *rw, co_coroutine_obj_t *co, co_bool_t writer) {
+	int busy = writer ? ~0 : (CO_RWLOCK_WRITER | CO_RWLOCK_QUEUED), state, next;
+	co_bool_t queued;
+	co_spin_lock(&rw->lock);
+	do {
+		state  = co_atom_peek(&rw->state);
+		queued = (state & busy) != 0;
+		if (queued)
+			next = state | CO_RWLOCK_QUEUED;
+		else
+			next = writer ? CO_RWLOCK_WRITER : state + CO_RWLOCK_READER;
+	} while (co_atom_cmpxchg(&rw->state, state, next) != state);
+	if (queued)
+		co_q_enq(writer ? &rw->writers : &rw->readers, &co->qe);
+	co_spin_unlock(&rw->lock);
+	return queued;
+}
+
+/**
+ * Hand lock over to waiters, nobody holds it, lock held
+ * @param readers_first Whether waiting readers go before waiting writers
+ * @note Internal
+ */
+static __inline__ void __co_rwlock_grant(co_multi_co_wq_t *wq, co_rwlock_t *rw, co_bool_t readers_first) {
+	co_queue_t granted = co_q_init();
+	co_list_e_t *e;
+	int state;
+	if (co_q_empty(&rw->writers) || (readers_first && !co_q_empty(&rw->readers))) {
+		granted     = rw->readers; /* All of them at once */
+		rw->readers = co_q_init();
+		state       = (int)granted.count * CO_RWLOCK_READER;
+	} else {
+		e = co_q_peek(&rw->writers);
+		co_q_deq(&rw->writers);
+		co_q_enq(&granted, e);
+		state = CO_RWLOCK_WRITER;
+	}
+	if (!co_q_empty(&rw->writers) || !co_q_empty(&rw->readers))
+		state |= CO_RWLOCK_QUEUED;
+	co_atom_set(&rw->state, state);
+	co_spin_unlock(&rw->lock);
+	for_each_drain_queue(e, &granted, co_q_peek, co_q_deq) {
+		__co_waitq_resume(wq, __co_container_of(e, co_coroutine_obj_t, qe));
+	}
+}
+
+/**
+ * Unlock after reading, handing over to the first waiting writer if last
+ * @note Internal, see co_rdunlock
+ */
+static __inline__ void __co_rwlock_rdunlock(co_multi_co_wq_t *wq, co_rwlock_t *rw) {
+	if (co_atom_sub(&rw->state, CO_RWLOCK_READER) != CO_RWLOCK_QUEUED)
+		return;
+	co_spin_lock(&rw->lock); /* Nobody holds and fast paths are closed, state cannot change under the lock */
+	__co_rwlock_grant(wq, rw, 0);
+}
+
+/**
+ * Unlock after writing, handing over to all waiting readers, or to the first waiting writer
+ * @note Internal, see co_wrunlock
+ */
+static __inline__ void __co_rwlock_wrunlock(co_multi_co_wq_t *wq, co_rwlock_t *rw) {
+	if (co_atom_cmpxchg(&rw->state, CO_RWLOCK_WRITER, 0) == CO_RWLOCK_WRITER)
+		return;
+	co_spin_lock(&rw->lock);
+	__co_rwlock_grant(wq, rw, 1);
+}
+
+/**
+ * Lock for reading, yield and park coroutine until it is handed over if a writer holds or waits
+ * @param self Calling coroutine
+ * @param rw Readers-writer lock pointer
+ */
+#define co_yield_rdlock(self, rw)                                                                                      \
+	if (!co_rwlock_try_rdlock(rw) && __co_rwlock_lock_or_queue(rw, &(self)->obj, 0)) {                                 \
+		co_yield_park(self); /* Woken up owning the lock */                                                            \
+	}
+
+/**
+ * Lock for writing, yield and park coroutine until it is handed over if anyone holds or waits
+ * @param self Calling coroutine
+ * @param rw Readers-writer lock pointer
+ */
+#define co_yield_wrlock(self, rw)                                                                                      \
+	if (!co_rwlock_try_wrlock(rw) && __co_rwlock_lock_or_queue(rw, &(self)->obj, 1)) {                                 \
+		co_yield_park(self); /* Woken up owning the lock */                                                            \
+	}
+
+/**
+ * Unlock after reading
+ * @param self Calling coroutine
+ * @param rw Readers-writer lock pointer
+ */
+#define co_rdunlock(self, rw) __co_rwlock_rdunlock((self)->obj.wq, rw)
+
+/**
+ * Unlock after writing
+ * @param self Calling coroutine
+ * @param rw Readers-writer lock pointer
+ */
+#define co_wrunlock(self, rw) __co_rwlock_wrunlock((self)->obj.wq, rw)
+
+#endif /*CO_LOCK_H*/
@@ -0,0 +1,162 @@
+#ifndef CO_MPSC_Q_H
+#define CO_MPSC_Q_H
+/**
+ * @file co_mpsc_q.h
+ *
+ * Multi producer single consumer queue
+ *
+ * Drop in alternative to multi source queue, same interface. Enqueue is wait
+ * free and never fails, whatever the contention.
+ *
+ * The idea (D. Vyukov's intrusive MPSC queue):
+ *    Producers atomically exchange the head pointer with the new element, then link
+ *    the previous head to it. Consumer walks the list from the tail. A stub element
+ *    owned by the queue keeps the list non empty, so producers never touch the tail.
+ *
+ *    A producer interrupted between the exchange and the link hides all elements
+ *    enqueued after it, until it completes. Consumer treats it as empty queue;
+ *    the producer rings the bell right after, so it is not missed.
+ *
+ *    Elements are moved into a private queue of the consumer on peek, so the rest
+ *    of the interface works as with multi source queue.
+ *
+ */
+
+#include "dep/co_list.h"
+#include "dep/co_types.h"
+
+typedef struct co_mpsc_q {
+	/** Last enqueued element, producers side */
+	co_list_e_t *head __attribute__((aligned(64)));
+	/** Oldest element, consumer side */
+	co_list_e_t *tail __attribute__((aligned(64)));
+	/** Stub element */
+	co_list_e_t stub;
+	/** Main queue, elements taken out already */
+	co_queue_t mq;
+} co_mpsc_q_t;
+
+/**
+ * Initialize MPSC queue
+ * @param q Queue pointer
+ * @param size Ignored, for compatibility with multi source queue
+ * @return 0
+ */
+static __inline__ co_errno_t co_mpsc_q_init(co_mpsc_q_t *q, co_size_t size) {
+	(void)size;
+	q->stub.next = NULL;
+	q->head      = &q->stub;
+	q->tail      = &q->stub;
+	q->mq        = co_q_init();
+	return 0;
+}
+
+/**
+ * Destroy MPSC queue
+ * @param q Queue pointer
+ */
+static __inline__ void co_mpsc_q_destroy(co_mpsc_q_t *q) { (void)q; }
+
+/**
+ * Equeue an element to the tail, from any thread
+ * @param q Queue pointer
+ * @param e Queue element
+ * @return 0, never fails
+ */
+static __inline__ co_errno_t co_mpsc_q_enq(co_mpsc_q_t *q, co_list_e_t *e) {
+	co_list_e_t *prev;
+	e->next = NULL;
+	prev    = __atomic_exchange_n(&q->head, e, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, e, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Take the oldest element out of the shared list
+ * @note Internal
+ * @return Element or NULL if empty, or the oldest element is not linked yet
+ */
+static __inline__ co_list_e_t *__co_mpsc_q_pop(co_mpsc_q_t *q) {
+	co_list_e_t *tail = q->tail, *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	if (tail == &q->stub) {
+		if (!next)
+			return NULL;
+		q->tail = tail = next;
+		next           = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+	}
+	if (next) {
+		q->tail = next;
+		return tail;
+	}
+	if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE))
+		return NULL; /* Producer is in the middle of enqueue */
+	/* Tail is the last one, put the stub behind it to be able to take it */
+	co_mpsc_q_enq(q, &q->stub);
+	if ((next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE)) != NULL) {
+		q->tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+/**
+ * Get the first element of queue without dequeueing it
+ * @param q Queue pointer
+ * @return Queue element or NULL if empty
+ */
+static __inline__ co_list_e_t *co_mpsc_q_peek(co_mpsc_q_t *q) {
+	if (co_q_empty(&q->mq)) {
+		co_list_e_t *e = __co_mpsc_q_pop(q);
+		if (e)
+			co_q_enq(&q->mq, e);
+	}
+	return co_q_peek(&q->mq);
+}
+
+/**
+ * Remove first element from queue
+ * Assumes queue is not empty. Check it before calling.
+ * @param q Queue pointer
+ */
+static __inline__ void co_mpsc_q_deq(co_mpsc_q_t *q) { co_q_deq(&q->mq); }
+
+/**
+ * Move queued elements to another queue
+ * Linked elements are moved as one chain, only the last one takes the slow path.
+ * @param q Queue pointer
+ * @param dst Destination queue
+ * @param max Max number of elements to move
+ * @return Number of elements moved
+ */
+static __inline__ co_size_t co_mpsc_q_drain(co_mpsc_q_t *q, co_queue_t *dst, co_size_t max) {
+	co_size_t moved = q->mq.count;
+	co_queue_t chain = co_q_init();
+	co_list_e_t *next, *e;
+	co_q_enq_q(dst, &q->mq);
+	if (q->tail == &q->stub) { /* Skip the stub */
+		if ((next = __atomic_load_n(&q->stub.next, __ATOMIC_ACQUIRE)) == NULL)
+			return moved;
+		q->tail = next;
+	}
+	/* Take every element that has a successor, except the one before the stub */
+	for (e = q->tail; moved + chain.count < max; e = next) {
+		if ((next = __atomic_load_n(&e->next, __ATOMIC_ACQUIRE)) == NULL || next == &q->stub)
+			break;
+		chain.tail = e;
+		++chain.count;
+	}
+	if (chain.count) {
+		chain.head       = q->tail;
+		q->tail          = e;
+		chain.tail->next = NULL;
+		moved += chain.count;
+		co_q_enq_q(dst, &chain);
+	}
+	while (moved < max && (e = __co_mpsc_q_pop(q)) != NULL) {
+		co_q_enq(dst, e);
+		++moved;
+	}
+	return moved;
+}
+
+#endif /*CO_MPSC_Q_H*/
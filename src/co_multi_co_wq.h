@@ -12,14 +12,229 @@
  */
 
 #include "co_coroutine_object.h"
-#include "co_multi_src_q.h"
 #include "dep/co_allocator.h"
 #include "dep/co_aux.h"
 #include "dep/co_dbg.h"
 #include "dep/co_list.h"
+#include "dep/co_pairing_heap.h"
 #include "dep/co_sync.h"
+#include "dep/co_timer_wheel.h"
 #include "dep/co_types.h"
 
+#ifdef CO_MULTI_CO_WQ_ARENA
+#	include "dep/co_arena.h"
+#endif
+
+#ifdef CO_MULTI_CO_WQ_MPSC
+#	include "co_mpsc_q.h"
+/* Input queue is a single list, enqueue is wait free */
+#	define co_multi_co_wq_inputq_t co_mpsc_q_t
+#	define co_multi_co_wq_inputq_init(...) co_mpsc_q_init(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_destroy(...) co_mpsc_q_destroy(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_enq(...) co_mpsc_q_enq(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_peek(...) co_mpsc_q_peek(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_deq(...) co_mpsc_q_deq(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_drain(...) co_mpsc_q_drain(__VA_ARGS__)
+#else
+#	include "co_multi_src_q.h"
+/* Input queue is sharded, enqueue may need to retry under contention */
+#	define co_multi_co_wq_inputq_t co_multi_src_q_t
+#	define co_multi_co_wq_inputq_init(...) co_multi_src_q_init(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_destroy(...) co_multi_src_q_destroy(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_enq(...) co_multi_src_q_enq(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_peek(...) co_multi_src_q_peek(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_deq(...) co_multi_src_q_deq(__VA_ARGS__)
+#	define co_multi_co_wq_inputq_drain(...) co_multi_src_q_drain(__VA_ARGS__)
+#endif
+
+#if defined(CO_MULTI_CO_WQ_EPOLL) && defined(CO_MULTI_CO_WQ_FUTEX)
+#	error "CO_MULTI_CO_WQ_EPOLL and CO_MULTI_CO_WQ_FUTEX are mutually exclusive"
+#endif
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+#	include "dep/co_epoll.h"
+/* Bell is epoll instance, which also watches file descriptors of parked coroutines */
+#	define co_multi_co_wq_bell_t co_epoll_t
+#	define co_multi_co_wq_bell_init(...) co_epoll_init(__VA_ARGS__)
+#	define co_multi_co_wq_bell_destroy(...) co_epoll_destroy(__VA_ARGS__)
+#	define co_multi_co_wq_bell_done(...) co_epoll_done(__VA_ARGS__)
+#	define co_multi_co_wq_bell_cheap (0)
+#elif defined(CO_MULTI_CO_WQ_FUTEX)
+#	include "dep/co_futex.h"
+/* Bell is a futex word, cheap enough to ring on every input */
+#	define co_multi_co_wq_bell_t co_futex_t
+#	define co_multi_co_wq_bell_init(...) co_futex_init(__VA_ARGS__)
+#	define co_multi_co_wq_bell_destroy(...) co_futex_destroy(__VA_ARGS__)
+#	define co_multi_co_wq_bell_done(...) co_futex_done(__VA_ARGS__)
+#	define co_multi_co_wq_bell_timedwait(...) co_futex_timedwait(__VA_ARGS__)
+#	define co_multi_co_wq_bell_cheap (1)
+#else
+#	define co_multi_co_wq_bell_t co_completion_t
+#	define co_multi_co_wq_bell_init(...) co_completion_init(__VA_ARGS__)
+#	define co_multi_co_wq_bell_destroy(...) co_completion_destroy(__VA_ARGS__)
+#	define co_multi_co_wq_bell_done(...) co_completion_done(__VA_ARGS__)
+#	define co_multi_co_wq_bell_timedwait(...) co_completion_timedwait(__VA_ARGS__)
+#	define co_multi_co_wq_bell_cheap (0)
+#endif
+
+/** Number of loop passes between checks of watched file descriptors, while there is other work to do */
+#ifndef CO_MULTI_CO_WQ_POLL_INTERVAL
+#	define CO_MULTI_CO_WQ_POLL_INTERVAL (64)
+#endif
+
+/** Max number of file descriptor events handled at once */
+#ifndef CO_MULTI_CO_WQ_POLL_BATCH
+#	define CO_MULTI_CO_WQ_POLL_BATCH (64)
+#endif
+
+/** Number of file descriptor records per page of fd table, see co_multi_co_wq_watch_fd */
+#ifndef CO_MULTI_CO_WQ_FD_PAGE
+#	define CO_MULTI_CO_WQ_FD_PAGE (256)
+#endif
+
+/** Number of input coroutines to move to execq per loop pass, whole input shards are moved until it is reached */
+#ifndef CO_MULTI_CO_WQ_INPUT_BATCH
+#	define CO_MULTI_CO_WQ_INPUT_BATCH (256)
+#endif
+
+/** Max number of coroutines run one after another by direct hand over, without going through execq, 0 disables */
+#ifndef CO_MULTI_CO_WQ_TRANSFER_DEPTH
+#	define CO_MULTI_CO_WQ_TRANSFER_DEPTH (16)
+#endif
+
+/** Number of priority levels of execq, see co_set_prio */
+#ifndef CO_MULTI_CO_WQ_PRIOS
+#	define CO_MULTI_CO_WQ_PRIOS (3)
+#endif
+
+#if CO_MULTI_CO_WQ_PRIOS > 1 << (CO_FLAGS_POOL_SHIFT - CO_FLAGS_PRIO_SHIFT)
+#	error "CO_MULTI_CO_WQ_PRIOS does not fit in coroutine flags"
+#endif
+
+/** Priority level of coroutines created without one */
+#ifndef CO_PRIO_DEFAULT
+#	define CO_PRIO_DEFAULT ((CO_MULTI_CO_WQ_PRIOS - 1) / 2)
+#endif
+
+/** Number of coroutines of higher levels run while a lower level waits, before it gets to run one */
+#ifndef CO_MULTI_CO_WQ_PRIO_AGING
+#	define CO_MULTI_CO_WQ_PRIO_AGING (32)
+#endif
+
+/* With CO_MULTI_CO_WQ_EDF, coroutines with a deadline run earliest deadline first, ahead of all levels */
+
+/* With CO_MULTI_CO_WQ_ARENA, co_new_arena creates coroutines whose descendants share one arena */
+
+/* With CO_MULTI_CO_WQ_GROUPS, co_yield_await_all and co_yield_await_any await several children at once */
+
+/* With CO_MULTI_CO_WQ_CANCEL, co_cancel cancels coroutines along with their descendants */
+
+/* With CO_MULTI_CO_WQ_AWAIT_TIMEOUT, co_yield_await_timeout awaits other coroutines until a deadline */
+
+/** Max number of coroutine types with frame pools, see co_routine_decl_pooled */
+#ifndef CO_MULTI_CO_WQ_POOLS
+#	define CO_MULTI_CO_WQ_POOLS (32)
+#endif
+
+/** Max number of free frames kept per pool, the rest go back to fast allocator */
+#ifndef CO_MULTI_CO_WQ_POOL_CAP
+#	define CO_MULTI_CO_WQ_POOL_CAP (1024)
+#endif
+
+/** Timer resolution of work queue, must divide a second */
+#ifndef CO_TIMER_TICK_NS
+#	define CO_TIMER_TICK_NS (1000000UL)
+#endif
+
+/** Default timer slack of work queue, deadlines are rounded up to its multiple */
+#ifndef CO_TIMER_SLACK_NS
+#	define CO_TIMER_SLACK_NS (0UL)
+#endif
+
+struct co_multi_co_wq;
+
+/**
+ * Work sharing interface
+ * Lets a group of work queues move runnable coroutines between each other.
+ * Standalone work queue has none. See co_runtime.h for implementation.
+ */
+typedef struct co_multi_co_wq_share {
+	/** Number of group members that ran out of work */
+	co_atom_t hungry;
+	/** Hand runnable coroutine over to a hungry member. Return 0 if it was taken. */
+	co_errno_t (*offer)(struct co_multi_co_wq_share *, struct co_multi_co_wq *, co_coroutine_obj_t *);
+	/** Move coroutines offered by other members to own execq. Return number of coroutines taken. */
+	co_size_t (*steal)(struct co_multi_co_wq_share *, struct co_multi_co_wq *);
+	/** Called on every loop pass that has work to do. Stop being hungry, take back own offers nobody took. */
+	void (*busy)(struct co_multi_co_wq_share *, struct co_multi_co_wq *);
+} co_multi_co_wq_share_t;
+
+/**
+ * Asynchronous I/O interface
+ * Lets work queue drive an I/O backend from its loop. See co_io.h for implementation.
+ */
+typedef struct co_multi_co_wq_io {
+	/** Number of operations whose completions are to be collected by poll */
+	co_size_t inflight;
+	/** File descriptor that becomes readable when there are completions, or -1 */
+	int fd;
+	/** Push pending submissions, reschedule coroutines of completed operations. Return number rescheduled. */
+	co_size_t (*poll)(struct co_multi_co_wq_io *, struct co_multi_co_wq *);
+} co_multi_co_wq_io_t;
+
+/**
+ * Free frames of a single coroutine type
+ */
+typedef struct co_multi_co_wq_pool {
+	/** Free frames */
+	co_list_e_t *free;
+	/** Number of free frames */
+	co_size_t count;
+} co_multi_co_wq_pool_t;
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+/**
+ * Coroutines parked on a single file descriptor, a reader and a writer
+ * Epoll watches the fd for the events of both merged.
+ */
+typedef struct co_multi_co_wq_fd {
+	/** File descriptor */
+	int fd;
+	/** Coroutine waiting for anything but EPOLLOUT, or NULL */
+	co_coroutine_obj_t *in;
+	/** Coroutine waiting for EPOLLOUT, or NULL */
+	co_coroutine_obj_t *out;
+	/** Events the reader waits for */
+	unsigned in_events;
+	/** Events the writer waits for */
+	unsigned out_events;
+} co_multi_co_wq_fd_t;
+#endif
+
+/**
+ * Pool ids handed out so far, shared by all translation units
+ * A program that uses frame pools defines it with co_multi_co_wq_define_pool_ids, in exactly one .c file.
+ */
+extern unsigned co_multi_co_wq_pool_ids;
+#define co_multi_co_wq_define_pool_ids() unsigned co_multi_co_wq_pool_ids = 0
+
+/** Pool id variable of a coroutine type that has no id yet, see co_routine_define_pool */
+#define CO_MULTI_CO_WQ_POOL_UNSET ((unsigned)-1)
+
+/**
+ * Get frame pool id of a coroutine type, taking a new one from the registry on first call
+ * The first caller to store its id wins, others use that one. Types first used by several threads
+ * at once may use up an extra id each, which stays unused.
+ * @param id Pool id variable of the type
+ * @return Pool id, or 0 if all are taken
+ */
+static __inline__ unsigned co_multi_co_wq_pool_register(unsigned *id) {
+	unsigned v = __sync_add_and_fetch(&co_multi_co_wq_pool_ids, 1), prev;
+	v          = v <= CO_MULTI_CO_WQ_POOLS ? v : 0;
+	prev       = co_word_cmpxchg(id, CO_MULTI_CO_WQ_POOL_UNSET, v);
+	return prev == CO_MULTI_CO_WQ_POOL_UNSET ? v : prev;
+}
+
 /**
  * The coroutines work queue object
  */
@@ -31,20 +246,48 @@ typedef struct co_multi_co_wq {
 
 	/** Bell encapsulator */
 	struct {
-		/** Indication that the wq wants to go to sleep */
+		/** Indication that the wq wants to go to sleep, unused with cheap bells */
 		co_atom_t wake_me_up;
-		/** Completion object - the bell */
-		co_completion_t bell;
+		/** The bell */
+		co_multi_co_wq_bell_t bell;
 	} bell;
 
 	/** Slow input queue - anyone can write here */
-	co_multi_src_q_t inputq;
+	co_multi_co_wq_inputq_t inputq;
 	/** Fast allocator - for allocation from coroutine wq thread, can be lockless */
 	co_allocator_t *fast_alloc;
 	/** Slow allocator - for allocation from any thread, must have locks */
 	co_allocator_t *slow_alloc;
-	/** Execution queue */
-	co_queue_t execq;
+	/** Frame pools of coroutine types, by pool id, index 0 unused */
+	co_multi_co_wq_pool_t pools[CO_MULTI_CO_WQ_POOLS + 1];
+	/** Execution queues, by priority level */
+	co_queue_t execq[CO_MULTI_CO_WQ_PRIOS];
+	/** Coroutines of higher levels run while each level waited */
+	co_size_t aging[CO_MULTI_CO_WQ_PRIOS];
+#ifdef CO_MULTI_CO_WQ_EDF
+	/** Execution queue of coroutines with a deadline, earliest first, ahead of all levels */
+	co_pheap_t edfq;
+	/** Number of coroutines that terminated past their deadline, see co_set_deadline */
+	co_size_t deadline_misses;
+#endif
+	/** Coroutines that broke inside synchronous call, freed once the caller yields */
+	co_queue_t reap;
+	/** Sleeping coroutines */
+	co_timer_wheel_t timers;
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	/** Number of coroutines parked on file descriptors */
+	co_size_t fd_waiters;
+	/** Loop passes left till next check of file descriptors */
+	co_size_t poll_countdown;
+	/** Pages of file descriptor records, indexed by fd, allocated on first wait */
+	co_multi_co_wq_fd_t **fd_pages;
+	/** Number of entries of fd_pages */
+	co_size_t fd_npages;
+#endif
+	/** Work sharing group this wq is a member of, or NULL */
+	co_multi_co_wq_share_t *share;
+	/** Asynchronous I/O backend, or NULL */
+	co_multi_co_wq_io_t *io;
 
 	/** */
 	co_abstime_t next_wakeup;
@@ -64,16 +307,47 @@ typedef struct co_multi_co_wq {
 #define co_multi_co_wq_alloc_fast(wq, size) co_multi_co_wq_alloc(wq, fast, size)
 #define co_multi_co_wq_alloc_slow(wq, size) co_multi_co_wq_alloc(wq, slow, size)
 
+/**
+ * Allocate coroutine frame on fast allocator, taking it from frame pool if there is one
+ * @param wq Coroutine work queue pointer
+ * @param pool Frame pool id of coroutine type, 0 if none
+ * @param size Frame size
+ * @return Allocated pointer or NULL
+ */
+static __inline__ void *co_multi_co_wq_alloc_pooled(co_multi_co_wq_t *wq, unsigned pool, co_size_t size) {
+	co_list_e_t *frame;
+	if (pool && (frame = wq->pools[pool].free) != NULL) {
+		wq->pools[pool].free = frame->next;
+		--wq->pools[pool].count;
+		return frame;
+	}
+	return co_multi_co_wq_alloc_fast(wq, size);
+}
+
 /**
  * Free memory allocated for coroutine
  * @param wq Coroutine work queue pointer
  * @param task Queue element of coroutine wq representing a coroutine
  */
 static __inline__ void co_multi_co_wq_free(co_multi_co_wq_t *wq, co_list_e_t *task) {
-	if (co_routine_flag_test(__co_container_of(task, co_coroutine_obj_t, qe)->flags, CO_FLAG_SLOW_ALLOC))
+	co_coroutine_obj_t *co       = __co_container_of(task, co_coroutine_obj_t, qe);
+	co_routine_flags_bmp_t flags = co->flags;
+	unsigned pool                = co_routine_flags_pool(flags);
+	if (co_routine_flag_test(flags, CO_FLAG_INPLACE)) {
+		/* Not ours */
+#ifdef CO_MULTI_CO_WQ_ARENA
+	} else if (co->arena) {
+		co_arena_put(co->arena, co, co->size); /* Released with the last object of arena */
+#endif
+	} else if (co_routine_flag_test(flags, CO_FLAG_SLOW_ALLOC)) {
 		wq->slow_alloc->free(wq->slow_alloc, task);
-	else
-		wq->fast_alloc->free(wq->slow_alloc, task);
+	} else if (pool && wq->pools[pool].count < CO_MULTI_CO_WQ_POOL_CAP) {
+		task->next           = wq->pools[pool].free;
+		wq->pools[pool].free = task;
+		++wq->pools[pool].count;
+	} else {
+		wq->fast_alloc->free(wq->fast_alloc, task);
+	}
 }
 
 /**
@@ -84,19 +358,35 @@ static __inline__ void co_multi_co_wq_free(co_multi_co_wq_t *wq, co_list_e_t *ta
  */
 static __inline__ co_errno_t co_multi_co_wq_init(co_multi_co_wq_t *wq, co_size_t size, co_allocator_t *fast_alloc,
                                                  co_allocator_t *slow_alloc) {
-	int rv;
+	int rv, i;
+	co_abstime_t now;
 	*wq = (co_multi_co_wq_t){.bell.wake_me_up = co_atom_init(0),
-	                         .execq           = co_q_init(),
+	                         .reap            = co_q_init(),
 	                         .fast_alloc      = fast_alloc,
 	                         .slow_alloc      = slow_alloc,
+	                         .share           = NULL,
+	                         .io              = NULL,
 	                         .terminate       = 0,
 	                         .next_wakeup     = co_invalid_abstime()};
-	rv  = co_completion_init(&wq->bell.bell);
+	for (i = 0; i < CO_MULTI_CO_WQ_PRIOS; ++i)
+		wq->execq[i] = co_q_init();
+#ifdef CO_MULTI_CO_WQ_EDF
+	wq->edfq            = co_pheap_init();
+	wq->deadline_misses = 0;
+#endif
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	wq->poll_countdown = CO_MULTI_CO_WQ_POLL_INTERVAL;
+	wq->fd_pages       = NULL;
+	wq->fd_npages      = 0;
+#endif
+	co_get_current_time(&now);
+	co_timer_wheel_init(&wq->timers, co_abstime_to_ns(&now) / CO_TIMER_TICK_NS, CO_TIMER_SLACK_NS / CO_TIMER_TICK_NS);
+	rv = co_multi_co_wq_bell_init(&wq->bell.bell);
 	if (rv)
 		return rv;
-	rv = co_multi_src_q_init(&wq->inputq, size);
+	rv = co_multi_co_wq_inputq_init(&wq->inputq, size);
 	if (rv) {
-		co_completion_destroy(&wq->bell.bell);
+		co_multi_co_wq_bell_destroy(&wq->bell.bell);
 		return rv;
 	}
 	return 0;
@@ -104,19 +394,768 @@ static __inline__ co_errno_t co_multi_co_wq_init(co_multi_co_wq_t *wq, co_size_t
 
 /**
  * Destroy work queue
- * Deallocate all objects in the queue before that
+ * Deallocate all objects in the queue before that: coroutines that are runnable, sleeping, scheduled and not
+ * taken yet, or parked on file descriptors. Work queue does not know of the others, the caller has to let them
+ * finish first, such as by co_cancel and running the loop: those parked on wait queues, channels, locks and
+ * promises, awaiting children, paused and dropped by the loop, or waiting for I/O, which must complete too.
  * @param wq Coroutine work queue pointer
  * @warning New calls arriving during destruction is undefined behaviour
  */
 static __inline__ void co_multi_co_wq_destroy(co_multi_co_wq_t *wq) {
-	void *task;
+	co_size_t i;
+	co_list_e_t *task;
+	co_hlist_t sleeping = co_hlist_init();
+
+	co_assert(!wq->io || !wq->io->inflight, "Work queue destroyed with I/O in flight\n");
+
+	for (i = 0; i < CO_MULTI_CO_WQ_PRIOS; ++i) {
+		for_each_drain_queue(task, &wq->execq[i], co_q_peek, co_q_deq) { co_multi_co_wq_free(wq, task); }
+	}
+#ifdef CO_MULTI_CO_WQ_EDF
+	while (!co_pheap_empty(&wq->edfq))
+		co_multi_co_wq_free(wq, &__co_container_of(co_pheap_pop(&wq->edfq), co_coroutine_obj_t, he)->qe);
+#endif
+
+	co_timer_wheel_drain(&wq->timers, &sleeping);
+	while (!co_hlist_empty(&sleeping)) {
+		co_sleep_t *sleeper = __co_container_of(sleeping.first, co_sleep_t, timer.e);
+		co_hlist_del(&sleeper->timer.e);
+		co_multi_co_wq_free(wq, &sleeper->co->qe);
+		wq->fast_alloc->free(wq->fast_alloc, sleeper);
+	}
+
+	for_each_drain_queue(task, &wq->inputq, co_multi_co_wq_inputq_peek, co_multi_co_wq_inputq_deq) {
+		co_multi_co_wq_free(wq, task);
+	}
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	for (i = 0; wq->fd_waiters && i < wq->fd_npages * CO_MULTI_CO_WQ_FD_PAGE; ++i) {
+		co_multi_co_wq_fd_t *rec = wq->fd_pages[i / CO_MULTI_CO_WQ_FD_PAGE];
+		if (!rec)
+			continue;
+		rec += i % CO_MULTI_CO_WQ_FD_PAGE;
+		if (rec->out == rec->in) /* Waits both ways, counted once */
+			rec->out = NULL;
+		if (rec->in) {
+			co_multi_co_wq_free(wq, &rec->in->qe);
+			--wq->fd_waiters;
+		}
+		if (rec->out) {
+			co_multi_co_wq_free(wq, &rec->out->qe);
+			--wq->fd_waiters;
+		}
+		rec->in = rec->out = NULL;
+	}
+#endif
+
+	for (i = 1; i <= CO_MULTI_CO_WQ_POOLS; ++i) {
+		while ((task = wq->pools[i].free) != NULL) {
+			wq->pools[i].free = task->next;
+			wq->fast_alloc->free(wq->fast_alloc, task);
+		}
+	}
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	for (i = 0; i < wq->fd_npages; ++i) {
+		if (wq->fd_pages[i])
+			wq->fast_alloc->free(wq->fast_alloc, wq->fd_pages[i]);
+	}
+	if (wq->fd_pages)
+		wq->fast_alloc->free(wq->fast_alloc, wq->fd_pages);
+#endif
+
+	co_multi_co_wq_inputq_destroy(&wq->inputq);
+	co_multi_co_wq_bell_destroy(&wq->bell.bell);
+}
+
+/** Deadline ordering key of coroutine without a deadline, later than any */
+#define CO_MULTI_CO_WQ_NO_DEADLINE (~0ULL)
+
+/**
+ * Deadline of coroutine as ordering key of deadline ordered execq
+ * @param co Coroutine object pointer
+ * @return Key, CO_MULTI_CO_WQ_NO_DEADLINE if it has none, always without CO_MULTI_CO_WQ_EDF
+ */
+static __inline__ unsigned long long co_multi_co_wq_deadline_key(co_coroutine_obj_t *co) {
+#ifdef CO_MULTI_CO_WQ_EDF
+	if (!co_is_invalid_abstime(&co->deadline))
+		return co_abstime_to_ns(&co->deadline);
+#endif
+	return CO_MULTI_CO_WQ_NO_DEADLINE;
+}
+
+/**
+ * Queue coroutine to run at given level, or by given deadline key if it is one
+ * @note Internal
+ */
+static __inline__ void __co_multi_co_wq_enq_at(co_multi_co_wq_t *wq, co_coroutine_obj_t *co, unsigned prio,
+                                               unsigned long long key) {
+#ifdef CO_MULTI_CO_WQ_EDF
+	if (key != CO_MULTI_CO_WQ_NO_DEADLINE) {
+		co_pheap_add(&wq->edfq, &co->he, key);
+		return;
+	}
+#endif
+	co_q_enq(&wq->execq[prio], &co->qe);
+}
+
+/**
+ * Queue coroutine to run, at its priority level, or by its deadline if it has one
+ * Must be called from the work queue thread.
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer, must not be in any queue
+ */
+static __inline__ void co_multi_co_wq_enq(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	__co_multi_co_wq_enq_at(wq, co, co_coroutine_obj_prio(co), co_multi_co_wq_deadline_key(co));
+}
+
+/**
+ * Queue all coroutines of a queue to run, each at its priority level
+ * @param wq Coroutine work queue pointer
+ * @param q Queue of coroutines, left empty
+ */
+static __inline__ void co_multi_co_wq_enq_q(co_multi_co_wq_t *wq, co_queue_t *q) {
+#if CO_MULTI_CO_WQ_PRIOS > 1 || defined(CO_MULTI_CO_WQ_EDF)
+	co_list_e_t *e;
+	for_each_drain_queue(e, q, co_q_peek, co_q_deq) {
+		co_multi_co_wq_enq(wq, __co_container_of(e, co_coroutine_obj_t, qe));
+	}
+#else
+	co_q_enq_q(&wq->execq[0], q);
+#endif
+}
+
+/**
+ * Number of coroutines queued to run, all levels together
+ * @param wq Coroutine work queue pointer
+ */
+static __inline__ co_size_t co_multi_co_wq_runnable(co_multi_co_wq_t *wq) {
+	co_size_t i, n = 0;
+	for (i = 0; i < CO_MULTI_CO_WQ_PRIOS; ++i)
+		n += wq->execq[i].count;
+#ifdef CO_MULTI_CO_WQ_EDF
+	n += wq->edfq.count;
+#endif
+	return n;
+}
+
+/**
+ * Take the next coroutine to run off execution queues
+ * It comes from the highest level with coroutines queued, unless a lower one waited for too long.
+ * Then the lowest such one gets to run one coroutine. Coroutines with a deadline go ahead of all
+ * levels, earliest deadline first.
+ * @param wq Coroutine work queue pointer, with coroutines queued
+ * @return Coroutine object pointer
+ */
+static __inline__ co_coroutine_obj_t *co_multi_co_wq_deq(co_multi_co_wq_t *wq) {
+	co_list_e_t *task;
+	int pick = 0;
+#if CO_MULTI_CO_WQ_PRIOS > 1 || defined(CO_MULTI_CO_WQ_EDF)
+	int i;
+#	ifdef CO_MULTI_CO_WQ_EDF
+	if (!co_pheap_empty(&wq->edfq))
+		pick = -1; /* Levels age against deadlines too */
+	else
+#	endif
+		while (co_q_empty(&wq->execq[pick]))
+			++pick;
+	for (i = pick + 1; i < CO_MULTI_CO_WQ_PRIOS; ++i)
+		if (!co_q_empty(&wq->execq[i]) && ++wq->aging[i] >= CO_MULTI_CO_WQ_PRIO_AGING)
+			pick = i;
+#	ifdef CO_MULTI_CO_WQ_EDF
+	if (pick < 0)
+		return __co_container_of(co_pheap_pop(&wq->edfq), co_coroutine_obj_t, he);
+#	endif
+	wq->aging[pick] = 0;
+#endif
+	task = co_q_peek(&wq->execq[pick]);
+	co_q_deq(&wq->execq[pick]);
+	return __co_container_of(task, co_coroutine_obj_t, qe);
+}
+
+/**
+ * Reschedule parked coroutine, can be called from any thread
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer, must not be in any queue
+ */
+void static __inline__ co_multi_co_wq_wake(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	while (co_multi_co_wq_inputq_enq(&wq->inputq, &co->qe) == -EAGAIN) /* Sharded queue only, very rare */
+		;
+	co_multi_co_wq_ring_the_bell(wq);
+}
+
+/**
+ * Set wake up time for main loop
+ * @param co Coroutine work queue pointer
+ * @param wakeup Absolute time to wake up
+ */
+void static __inline __co_adjust_wake_up(co_multi_co_wq_t *wq, const co_abstime_t *wakeup) {
+	if (co_is_invalid_abstime(&wq->next_wakeup) || co_get_time_ge(&wq->next_wakeup, wakeup))
+		wq->next_wakeup = *wakeup;
+}
+
+/**
+ * Set timer slack of work queue
+ * Deadlines of sleeping coroutines are rounded up to its multiple, so nearby
+ * deadlines are coalesced into one wake up.
+ * @param wq Coroutine work queue pointer
+ * @param slack Slack in nanoseconds, 0 for exact deadlines
+ */
+static __inline__ void co_multi_co_wq_set_timer_slack(co_multi_co_wq_t *wq, co_nanosec_t slack) {
+	wq->timers.slack = slack / CO_TIMER_TICK_NS;
+}
+
+/**
+ * Put coroutine in work queue timer wheel, with a timer allocated on the fast allocator
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer
+ * @param timeout Time to sleep in nanoseconds
+ * @return 1 if timer was added, 0 if there was no memory for it
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_multi_co_wq_add_timer(co_multi_co_wq_t *wq, co_coroutine_obj_t *co,
+                                                       co_nanosec_t timeout) {
+	co_sleep_t *sleeper = co_multi_co_wq_alloc_fast(wq, sizeof(co_sleep_t));
+	co_abstime_t now;
+	co_tick_t now_tick;
+	if (!sleeper)
+		return 0;
+	sleeper->co = co;
+	co->sleep   = sleeper;
+	co_get_current_time(&now);
+	now_tick = co_abstime_to_ns(&now) / CO_TIMER_TICK_NS;
+	if (!wq->timers.count)
+		wq->timers.now = now_tick; /* Nothing pending, time can simply jump */
+	/* Round up, never wake up early */
+	co_timer_wheel_add(&wq->timers, &sleeper->timer,
+	                   (co_abstime_to_ns(&now) + timeout + CO_TIMER_TICK_NS - 1) / CO_TIMER_TICK_NS);
+	return 1;
+}
+
+/**
+ * Take coroutine timer out of work queue timer wheel, and free it
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer, sleeping
+ * @note Internal
+ */
+static __inline__ void __co_multi_co_wq_del_timer(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	co_timer_wheel_del(&wq->timers, &co->sleep->timer);
+	wq->fast_alloc->free(wq->fast_alloc, co->sleep);
+	co->sleep = NULL;
+}
+
+/**
+ * Park coroutine in work queue timer wheel
+ * Without memory for its timer, coroutine is queued to run right away, as if time passed.
+ * Must be called from the work queue thread.
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer, must not be in any queue
+ * @param timeout Time to sleep in nanoseconds
+ */
+static __inline__ void co_multi_co_wq_sleep(co_multi_co_wq_t *wq, co_coroutine_obj_t *co, co_nanosec_t timeout) {
+	if (!__co_multi_co_wq_add_timer(wq, co, timeout))
+		co_multi_co_wq_enq(wq, co);
+}
+
+#ifdef CO_MULTI_CO_WQ_AWAIT_TIMEOUT
+/**
+ * Take coroutine off the await list of coroutine it awaits until its timer expires
+ * @param co Coroutine object pointer, awaiting with deadline
+ */
+static __inline__ void __co_multi_co_wq_unawait(co_coroutine_obj_t *co) {
+	co_list_e_t **pprev = &co->awaited->await;
+	while (*pprev != &co->qe)
+		pprev = &(*pprev)->next;
+	*pprev      = co->qe.next;
+	co->awaited = NULL;
+}
+#endif
+
+/**
+ * Stop timer of coroutine woken up by the coroutine it awaits, if it awaited with deadline
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer, just taken off await list
+ */
+static __inline__ void co_multi_co_wq_await_done(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+#ifdef CO_MULTI_CO_WQ_AWAIT_TIMEOUT
+	if (co->awaited) {
+		__co_multi_co_wq_del_timer(wq, co);
+		co->awaited = NULL;
+	}
+#endif
+}
+
+#ifdef CO_MULTI_CO_WQ_AWAIT_TIMEOUT
+/**
+ * Await coroutine until deadline, coroutine is already in its await list
+ * Without memory for its timer, coroutine times out right away.
+ * Must be called from the work queue thread.
+ * @param wq Coroutine work queue pointer
+ * @param co Awaiting coroutine object pointer
+ * @param target Awaited coroutine object pointer
+ * @param timeout Time to await in nanoseconds
+ */
+static __inline__ void co_multi_co_wq_await_deadline(co_multi_co_wq_t *wq, co_coroutine_obj_t *co,
+                                                     co_coroutine_obj_t *target, co_nanosec_t timeout) {
+	if (co_routine_flag_test(co->flags, CO_FLAG_TIMEDOUT))
+		co_routine_flag_clear_atomic(&co->flags, CO_FLAG_TIMEDOUT);
+	co->awaited = target;
+	if (!__co_multi_co_wq_add_timer(wq, co, timeout)) { /* Gives up right away */
+		__co_multi_co_wq_unawait(co);
+		co_routine_flag_set_atomic(&co->flags, CO_FLAG_TIMEDOUT);
+		co_multi_co_wq_enq(wq, co);
+	}
+}
+#endif
+
+/**
+ * Reschedule coroutines whose timers expired
+ * Those awaiting with deadline are taken off await lists, and marked as timed out.
+ * @param wq Coroutine work queue pointer
+ * @return Number of coroutines rescheduled
+ */
+static __inline__ co_size_t co_multi_co_wq_expire_timers(co_multi_co_wq_t *wq) {
+	co_hlist_t expired = co_hlist_init();
+	co_abstime_t now;
+	co_size_t n = 0;
+	if (!wq->timers.count)
+		return 0;
+	co_get_current_time(&now);
+	co_timer_wheel_advance(&wq->timers, co_abstime_to_ns(&now) / CO_TIMER_TICK_NS, &expired);
+	while (!co_hlist_empty(&expired)) {
+		co_sleep_t *sleeper    = __co_container_of(expired.first, co_sleep_t, timer.e);
+		co_coroutine_obj_t *co = sleeper->co;
+		co_hlist_del(&sleeper->timer.e);
+		wq->fast_alloc->free(wq->fast_alloc, sleeper);
+		co->sleep = NULL;
+#ifdef CO_MULTI_CO_WQ_AWAIT_TIMEOUT
+		if (co->awaited) {
+			__co_multi_co_wq_unawait(co);
+			co_routine_flag_set_atomic(&co->flags, CO_FLAG_TIMEDOUT);
+		}
+#endif
+		co_multi_co_wq_enq(wq, co);
+		++n;
+	}
+	return n;
+}
+
+/**
+ * Let main loop wake up for the next timer
+ * @param wq Coroutine work queue pointer
+ */
+static __inline__ void co_multi_co_wq_arm_timers(co_multi_co_wq_t *wq) {
+	co_tick_t next;
+	if (wq->timers.count && co_timer_wheel_next(&wq->timers, &next)) {
+		co_abstime_t wakeup = co_ns_to_abstime(next * CO_TIMER_TICK_NS);
+		__co_adjust_wake_up(wq, &wakeup);
+	}
+}
+
+#ifdef CO_MULTI_CO_WQ_EPOLL
+/**
+ * Find record of file descriptor, allocating its page on first use
+ * Pages never move, so epoll reports a pointer to the record itself.
+ * @return Record, or NULL if out of memory
+ * @note Internal
+ */
+static __inline__ co_multi_co_wq_fd_t *__co_multi_co_wq_fd(co_multi_co_wq_t *wq, int fd) {
+	co_size_t page = (co_size_t)fd / CO_MULTI_CO_WQ_FD_PAGE, n, i;
+	co_multi_co_wq_fd_t **pages, *recs;
+	if (page >= wq->fd_npages) {
+		for (n = wq->fd_npages ? wq->fd_npages * 2 : 1; n <= page; n *= 2)
+			;
+		if ((pages = co_multi_co_wq_alloc_fast(wq, n * sizeof(*pages))) == NULL)
+			return NULL;
+		for (i = 0; i < n; ++i)
+			pages[i] = i < wq->fd_npages ? wq->fd_pages[i] : NULL;
+		if (wq->fd_pages)
+			wq->fast_alloc->free(wq->fast_alloc, wq->fd_pages);
+		wq->fd_pages  = pages;
+		wq->fd_npages = n;
+	}
+	if (!wq->fd_pages[page]) {
+		if ((recs = co_multi_co_wq_alloc_fast(wq, CO_MULTI_CO_WQ_FD_PAGE * sizeof(*recs))) == NULL)
+			return NULL;
+		for (i = 0; i < CO_MULTI_CO_WQ_FD_PAGE; ++i)
+			recs[i] = (co_multi_co_wq_fd_t){(int)(page * CO_MULTI_CO_WQ_FD_PAGE + i), NULL, NULL, 0, 0};
+		wq->fd_pages[page] = recs;
+	}
+	return &wq->fd_pages[page][fd % CO_MULTI_CO_WQ_FD_PAGE];
+}
+
+/**
+ * Watch file descriptor for events of all its waiters merged
+ * @note Internal
+ */
+static __inline__ co_errno_t __co_multi_co_wq_arm_fd(co_multi_co_wq_t *wq, co_multi_co_wq_fd_t *rec) {
+	return co_epoll_watch(&wq->bell.bell, rec->fd, (rec->in ? rec->in_events : 0) | (rec->out ? rec->out_events : 0),
+	                      rec);
+}
+
+/**
+ * Park coroutine until file descriptor is ready
+ * A file descriptor has a reader slot, for coroutine waiting for anything but EPOLLOUT, and a writer
+ * slot, for one waiting for EPOLLOUT, one waiting for both takes both. Each slot holds a single
+ * coroutine at a time. Must be called from the work queue thread.
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer, must not be in any queue
+ * @param fd File descriptor
+ * @param events Epoll events to wait for
+ * @return 0 or error code, EEXIST if another coroutine holds the slot
+ */
+static __inline__ co_errno_t co_multi_co_wq_watch_fd(co_multi_co_wq_t *wq, co_coroutine_obj_t *co, int fd,
+                                                     unsigned events) {
+	co_bool_t out = (events & EPOLLOUT) != 0, in = (events & ~EPOLLOUT) != 0 || !out;
+	co_multi_co_wq_fd_t *rec;
+	co_errno_t rv;
+	if (fd < 0)
+		return EBADF;
+	if ((rec = __co_multi_co_wq_fd(wq, fd)) == NULL)
+		return ENOMEM;
+	if ((in && rec->in) || (out && rec->out))
+		return EEXIST;
+	if (in) {
+		rec->in        = co;
+		rec->in_events = events;
+	}
+	if (out) {
+		rec->out        = co;
+		rec->out_events = events;
+	}
+	if ((rv = __co_multi_co_wq_arm_fd(wq, rec)) != 0) {
+		if (in)
+			rec->in = NULL;
+		if (out)
+			rec->out = NULL;
+		return rv;
+	}
+	++wq->fd_waiters;
+	return 0;
+}
+
+/**
+ * Reschedule waiters of file descriptor that epoll reported, and watch it again for the rest
+ * @param wq Coroutine work queue pointer
+ * @param rec File descriptor record
+ * @param revents Reported events
+ * @return Number of coroutines rescheduled
+ */
+static __inline__ int co_multi_co_wq_fd_ready(co_multi_co_wq_t *wq, co_multi_co_wq_fd_t *rec, unsigned revents) {
+	co_coroutine_obj_t *in = rec->in, *out = rec->out;
+	int woken              = 0;
+	if (in && (in == out || (revents & (rec->in_events | EPOLLERR | EPOLLHUP)))) {
+		rec->in = NULL;
+		if (in == out)
+			rec->out = out = NULL; /* Waits both ways, woken once */
+		co_multi_co_wq_enq(wq, in);
+		++woken;
+	}
+	if (out && (revents & (rec->out_events | EPOLLERR | EPOLLHUP))) { /* Errors are reported to both */
+		rec->out = NULL;
+		co_multi_co_wq_enq(wq, out);
+		++woken;
+	}
+	if ((rec->in || rec->out) && __co_multi_co_wq_arm_fd(wq, rec)) {
+		/* Cannot watch for the other one any longer, let it retry by itself */
+		if ((in = rec->in) != NULL)
+			co_multi_co_wq_enq(wq, in);
+		if ((out = rec->out) != NULL)
+			co_multi_co_wq_enq(wq, out);
+		woken += (in != NULL) + (out != NULL);
+		rec->in = rec->out = NULL;
+	}
+	wq->fd_waiters -= woken;
+	return woken;
+}
+
+/**
+ * Test whether any coroutine waits on file descriptor
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_multi_co_wq_fd_waited(co_multi_co_wq_t *wq, int fd) {
+	co_size_t page = (co_size_t)fd / CO_MULTI_CO_WQ_FD_PAGE;
+	co_multi_co_wq_fd_t *rec;
+	if (page >= wq->fd_npages || !wq->fd_pages[page])
+		return 0;
+	rec = &wq->fd_pages[page][fd % CO_MULTI_CO_WQ_FD_PAGE];
+	return rec->in || rec->out;
+}
+
+/**
+ * Stop watching file descriptor
+ * Needed only if fd stays open after coroutines are done with it. It must have no waiters.
+ * @param wq Coroutine work queue pointer
+ * @param fd File descriptor
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_multi_co_wq_forget_fd(co_multi_co_wq_t *wq, int fd) {
+	co_assert(!__co_multi_co_wq_fd_waited(wq, fd), "File descriptor forgotten while waited on\n");
+	return co_epoll_forget(&wq->bell.bell, fd);
+}
+#endif
+
+/**
+ * Attach asynchronous I/O backend to work queue
+ * @param wq Coroutine work queue pointer
+ * @param io I/O backend
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_multi_co_wq_attach_io(co_multi_co_wq_t *wq, co_multi_co_wq_io_t *io) {
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	co_errno_t rv;
+	/* Pointer to io tells completions apart from coroutines waiting on fds */
+	if (io->fd >= 0 && (rv = co_epoll_add(&wq->bell.bell, io->fd, EPOLLIN, io)) != 0)
+		return rv;
+#else
+	co_assert(io->fd < 0, "I/O backend with completion fd requires CO_MULTI_CO_WQ_EPOLL\n");
+#endif
+	wq->io = io;
+	return 0;
+}
+
+/**
+ * Detach asynchronous I/O backend from work queue
+ * @param wq Coroutine work queue pointer
+ */
+static __inline__ void co_multi_co_wq_detach_io(co_multi_co_wq_t *wq) {
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	if (wq->io && wq->io->fd >= 0)
+		co_epoll_forget(&wq->bell.bell, wq->io->fd);
+#endif
+	wq->io = NULL;
+}
+
+/**
+ * Let I/O backend submit and complete its operations
+ * @param wq Coroutine work queue pointer
+ * @return Number of coroutines rescheduled
+ */
+static __inline__ co_size_t co_multi_co_wq_poll_io(co_multi_co_wq_t *wq) {
+	return wq->io && wq->io->inflight ? wq->io->poll(wq->io, wq) : 0;
+}
+
+/**
+ * Collect events of the bell, rescheduling coroutines whose file descriptors are ready
+ * @param wq Coroutine work queue pointer
+ * @param until Absolute time to sleep until if nothing happens, invalid time to sleep forever, NULL not to sleep
+ * @return Number of coroutines rescheduled or negative error code
+ */
+static __inline__ int co_multi_co_wq_poll(co_multi_co_wq_t *wq, co_abstime_t *until) {
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	struct epoll_event events[CO_MULTI_CO_WQ_POLL_BATCH];
+	int n, i, woken = 0;
+	wq->poll_countdown = CO_MULTI_CO_WQ_POLL_INTERVAL;
+	if (!until && !wq->fd_waiters)
+		return 0;
+	if ((n = co_epoll_timedwait(&wq->bell.bell, until, events, CO_MULTI_CO_WQ_POLL_BATCH)) < 0)
+		return n;
+	for (i = 0; i < n; ++i) {
+		if (events[i].data.ptr == wq->io) {
+			woken += co_multi_co_wq_poll_io(wq);
+			continue;
+		}
+		woken += co_multi_co_wq_fd_ready(wq, (co_multi_co_wq_fd_t *)events[i].data.ptr, events[i].events);
+	}
+	return woken;
+#else
+	co_errno_t rv;
+	if (!until)
+		return 0;
+	rv = co_multi_co_wq_bell_timedwait(&wq->bell.bell, until);
+	return rv == ETIMEDOUT ? 0 : -rv;
+#endif
+}
 
-	for_each_drain_queue(task, &wq->execq, co_q_peek, co_q_deq) { co_multi_co_wq_free(wq, task); }
+/**
+ * Test whether it is time to check file descriptors while there is other work to do
+ * @param wq Coroutine work queue pointer
+ * @return 1 if should poll else 0
+ */
+static __inline__ co_bool_t co_multi_co_wq_should_poll(co_multi_co_wq_t *wq) {
+#ifdef CO_MULTI_CO_WQ_EPOLL
+	return wq->fd_waiters && !--wq->poll_countdown;
+#else
+	return 0;
+#endif
+}
 
-	for_each_drain_queue(task, &wq->inputq, co_multi_src_q_peek, co_multi_src_q_deq) { co_multi_co_wq_free(wq, task); }
+/**
+ * Test whether it is worth offering coroutine to work sharing group
+ * Cheap test, before calling the offer hook.
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine just dequeued from execq
+ * @return 1 if should offer else 0
+ */
+static __inline__ co_bool_t co_multi_co_wq_should_offer(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	return wq->share && co_atom_peek(&wq->share->hungry) > 0 && co_is_migratable(co) &&
+	       (co_multi_co_wq_runnable(wq) || co_multi_co_wq_inputq_peek(&wq->inputq)); /* Keep something to do */
+}
 
-	co_multi_src_q_destroy(&wq->inputq);
-	co_completion_destroy(&wq->bell.bell);
+/**
+ * Test whether coroutine that yielded a result can hand over to its parent directly
+ * Only a single awaiting parent that is not paused is resumed right away, others go through execq.
+ * @param co Coroutine that returned or broke
+ * @param depth Number of hand overs done so far in a row
+ * @return 1 if can hand over else 0
+ */
+static __inline__ co_bool_t co_multi_co_wq_can_transfer(co_coroutine_obj_t *co, co_size_t depth) {
+	return depth < CO_MULTI_CO_WQ_TRANSFER_DEPTH && co->await && !co->await->next &&
+	       !co_is_terminated(__co_container_of(co->await, co_coroutine_obj_t, qe)) &&
+	       !co_routine_flag_test(__co_container_of(co->await, co_coroutine_obj_t, qe)->flags, CO_FLAG_PAUSED);
+}
+
+/**
+ * Reschedule coroutines woken up by one that returned or broke, then the coroutine itself behind them
+ * They all go to one queue, so that those woken up run before it runs again or is freed, and may still look
+ * at it: the highest level among them, as a lower one may age ahead, or with CO_MULTI_CO_WQ_EDF, if they all
+ * have a deadline, the deadline ordered one, where it goes no earlier than the latest of them.
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine that returned or broke, its await list is emptied
+ * @param joiner Parent of its await group if it is due, else NULL
+ * @param requeue 1 to queue the coroutine itself too, 0 if it broke and lives in storage of its owner
+ */
+static __inline__ void co_multi_co_wq_enq_woken(co_multi_co_wq_t *wq, co_coroutine_obj_t *co,
+                                                co_coroutine_obj_t *joiner, co_bool_t requeue) {
+	unsigned prio          = CO_MULTI_CO_WQ_PRIOS; /* Highest level among those woken up, none yet */
+	unsigned long long key = 0;                    /* Latest deadline among them, none if one has none */
+	co_list_e_t *e;
+	if (joiner) { /* Group parent is woken up as those awaiting it, not in any await list */
+		joiner->qe.next = co->await;
+		co->await       = &joiner->qe;
+	}
+	for_each_co_list(e, co->await) {
+		co_coroutine_obj_t *woken = __co_container_of(e, co_coroutine_obj_t, qe);
+		if (co_coroutine_obj_prio(woken) < prio)
+			prio = co_coroutine_obj_prio(woken);
+		if (co_multi_co_wq_deadline_key(woken) > key)
+			key = co_multi_co_wq_deadline_key(woken);
+	}
+	while (co->await) {
+		co_coroutine_obj_t *woken = __co_container_of(co->await, co_coroutine_obj_t, qe);
+		co->await                 = woken->qe.next;
+		co_multi_co_wq_await_done(wq, woken);
+		__co_multi_co_wq_enq_at(wq, woken, prio,
+		                        key != CO_MULTI_CO_WQ_NO_DEADLINE ? co_multi_co_wq_deadline_key(woken) : key);
+	}
+	if (!requeue)
+		return;
+	if (prio == CO_MULTI_CO_WQ_PRIOS) {
+		co_multi_co_wq_enq(wq, co); /* Nobody to run first */
+		return;
+	}
+	if (key != CO_MULTI_CO_WQ_NO_DEADLINE && co_multi_co_wq_deadline_key(co) != CO_MULTI_CO_WQ_NO_DEADLINE &&
+	    co_multi_co_wq_deadline_key(co) > key)
+		key = co_multi_co_wq_deadline_key(co);
+	__co_multi_co_wq_enq_at(wq, co, prio, key);
+}
+
+/**
+ * Tell await group of coroutine, if any, that it terminated
+ * @param co Terminated coroutine
+ * @return Awaiting parent if it is due now, else NULL. Caller must run it before the child is freed,
+ *         or queue both with co_multi_co_wq_enq_woken.
+ */
+static __inline__ co_coroutine_obj_t *co_multi_co_wq_group_done(co_coroutine_obj_t *co) {
+#ifdef CO_MULTI_CO_WQ_GROUPS
+	co_await_group_t *group = co->group;
+	if (!group)
+		return NULL;
+	co->group = NULL;
+	if (!group->first)
+		group->first = co;
+	return --group->pending == group->wake_at ? group->parent : NULL;
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * Unlink terminated coroutine from its parent, and its children from it
+ * Children outlive it as orphans. Those still in its await group leave the group, which goes away with it.
+ * Counts a deadline miss if it terminated past its deadline, unless its parent still runs.
+ * @param co Terminated coroutine
+ */
+static __inline__ void co_multi_co_wq_detach(co_coroutine_obj_t *co) {
+#ifdef CO_COROUTINE_OBJ_CHILDREN
+	if (co_hlist_linked(&co->sibling))
+		co_hlist_del(&co->sibling);
+#	ifdef CO_MULTI_CO_WQ_EDF
+	else if (!co_is_invalid_abstime(&co->deadline) && co_time_passed(&co->deadline))
+		++co->wq->deadline_misses;
+	co->deadline = co_invalid_abstime(); /* Met or missed, and not counted again once freed */
+#	endif
+	while (!co_hlist_empty(&co->children)) {
+		co_coroutine_obj_t *child = __co_container_of(co->children.first, co_coroutine_obj_t, sibling);
+#	ifdef CO_MULTI_CO_WQ_GROUPS
+		if (child->group && child->group->parent == co)
+			child->group = NULL;
+#	endif
+		co_hlist_del(&child->sibling);
+	}
+#endif
+}
+
+#ifdef CO_MULTI_CO_WQ_CANCEL
+/**
+ * Cancel coroutine, and all its descendants
+ * Each of them takes the cancellation the next time it is resumed: it runs its cancellation handler
+ * instead, or terminates right away if it has none. Sleepers are woken up for it right away. Those
+ * parked elsewhere take it once woken up, owning whatever they waited for, those awaiting a descendant
+ * once it terminates. Must be called from the work queue thread.
+ * @param wq Coroutine work queue pointer
+ * @param co Coroutine object pointer
+ */
+static __inline__ void co_multi_co_wq_cancel(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	co_hlist_e_t *e;
+	if (co_is_terminated(co) || co_is_cancelled(co))
+		return;
+	co_routine_flag_set_atomic(&co->flags, CO_FLAG_CANCEL);
+	if (co->sleep) {
+		__co_multi_co_wq_del_timer(wq, co);
+#	ifdef CO_MULTI_CO_WQ_AWAIT_TIMEOUT
+		if (co->awaited)
+			__co_multi_co_wq_unawait(co);
+#	endif
+		co_multi_co_wq_enq(wq, co);
+	}
+	for_each_co_list(e, co->children.first) {
+		co_multi_co_wq_cancel(wq, __co_container_of(e, co_coroutine_obj_t, sibling));
+	}
+}
+#endif
+
+/**
+ * Run child coroutine synchronously, from its parent
+ * Child ends up where the loop would have put it had it run from execq, except that one that broke
+ * is freed as soon as the caller yields, rather than on its turn in execq, unless it woke up the parent
+ * of its await group.
+ * @param wq Coroutine work queue pointer
+ * @param co Child coroutine, created and not run yet
+ * @return 1 if child returned or broke, so that parent may go on, 0 if it suspended, so that parent has to await it
+ */
+static __inline__ co_bool_t co_multi_co_wq_call(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	co_coroutine_obj_t *joiner;
+	co_dbg_trace("Calling <%s>\n", co->func_name);
+	switch (co->func(co)) {
+		case CO_RV_YIELD_BREAK:
+			co_routine_flag_set_atomic(&co->flags, CO_FLAG_TERM);
+			co_multi_co_wq_detach(co);
+			joiner = co_multi_co_wq_group_done(co);
+			if (joiner) /* Group parent may still look at it too */
+				co_multi_co_wq_enq_woken(wq, co, joiner, !co_routine_flag_test(co->flags, CO_FLAG_INPLACE));
+			else if (!co_routine_flag_test(co->flags, CO_FLAG_INPLACE))
+				co_q_enq(&wq->reap, &co->qe); /* Caller may still look at it */
+			return 1;
+		case CO_RV_YIELD_RETURN:
+			co_multi_co_wq_enq(wq, co); /* To go on */
+			return 1;
+		case CO_RV_YIELD_COND_WAIT:
+			co_multi_co_wq_enq(wq, co); /* To re-test later */
+			return 0;
+		default:
+			return 0; /* Awaits or parked, whoever it waits for reschedules it */
+	}
 }
 
 /**
@@ -129,69 +1168,157 @@ static __inline__ co_errno_t co_multi_co_wq_loop(co_multi_co_wq_t *wq) {
 	co_bool_t b4sleep = 0; /* Whether or not we are planning to go to sleep next round */
 	while (!wq->terminate) {
 		do {
-			co_size_t initial_size = wq->execq.count;
+			co_size_t initial_size;
+			co_coroutine_obj_t *handed = NULL; /* Child that handed over to its parent, still to run */
+			co_queue_t inputs          = co_q_init();
 			int i;
+			/* 0. Wake up sleepers whose time has come, those whose I/O completed, and those whose fds are ready */
+			co_multi_co_wq_expire_timers(wq);
+			co_multi_co_wq_poll_io(wq);
+			if (co_multi_co_wq_should_poll(wq))
+				co_multi_co_wq_poll(wq, NULL);
+			if (wq->share && (co_multi_co_wq_runnable(wq) || co_multi_co_wq_inputq_peek(&wq->inputq)))
+				wq->share->busy(wq->share, wq);
+			initial_size = co_multi_co_wq_runnable(wq);
 			/* 1. Start with draining the exec queues */
 			for (i = 0; i < initial_size; ++i) {
-				co_list_e_t *task             = co_q_peek(&wq->execq); /* Attempt to get a new taks */
-				co_coroutine_obj_t *coroutine = __co_container_of(task, co_coroutine_obj_t, qe); /* Extract coroutine */
+				co_coroutine_obj_t *coroutine = co_multi_co_wq_deq(wq); /* Attempt to get a new taks */
+				co_list_e_t *task             = &coroutine->qe;
+				co_size_t depth               = 0; /* Hand overs done in a row */
+				co_coroutine_obj_t *parent; /* Resumed right away by a child that returned or broke */
+				co_coroutine_obj_t *joiner; /* Parent of await group of a child that broke, due now */
+				co_list_e_t *reaped;
 				co_yield_rv_t co_rv;
 
-				co_q_deq(&wq->execq);
-
-				if (co_is_terminated(coroutine)) {
+				if (co_coroutine_obj_hold(coroutine)) {
+					co_dbg_trace("Coroutine <%s> is paused, dropping\n", coroutine->func_name);
+					continue; /* co_run will queue it again */
+				} else if (co_is_terminated(coroutine)) {
 					co_dbg_trace("Coroutine <%s> is terminated, freeing\n", coroutine->func_name);
+					co_multi_co_wq_detach(coroutine); /* Forced, never got to tell */
+					if ((joiner = co_multi_co_wq_group_done(coroutine)) != NULL) {
+						co_multi_co_wq_enq_woken(wq, coroutine, joiner, 1); /* Freed once group parent ran */
+						break;
+					}
 					co_multi_co_wq_free(wq, task); /* Free */
 					break;                         /* Next taks */
 				}
-				co_dbg_trace("Going to call <%s>\n", coroutine->func_name);
-				co_rv = coroutine->func(coroutine);
+				if (co_multi_co_wq_should_offer(wq, coroutine) && !wq->share->offer(wq->share, wq, coroutine)) {
+					co_dbg_trace("Coroutine <%s> was handed over to sibling\n", coroutine->func_name);
+					continue; /* Not mine anymore */
+				}
+			run:
+				if (co_coroutine_obj_cancel_due(coroutine) && !co_coroutine_obj_take_cancel(coroutine)) {
+					co_dbg_trace("Coroutine <%s> is cancelled, terminating\n", coroutine->func_name);
+					co_rv = CO_RV_YIELD_BREAK; /* Nothing to clean up */
+				} else {
+					co_dbg_trace("Going to call <%s>\n", coroutine->func_name);
+					co_rv = coroutine->func(coroutine);
+				}
 				co_dbg_trace("Call result: <%d>\n", co_rv);
+				for_each_drain_queue(reaped, &wq->reap, co_q_peek, co_q_deq) { co_multi_co_wq_free(wq, reaped); }
 				switch (co_rv) {
 					case CO_RV_YIELD_RETURN:
 					case CO_RV_YIELD_BREAK:
-						while (coroutine->await) { /* If it is a child coroutine, reschedule its parents. */
-							co_list_e_t *pending = coroutine->await;
-							coroutine->await     = pending->next;
-							co_q_enq(&wq->execq, pending);
+						parent = NULL;
+						if (co_multi_co_wq_can_transfer(coroutine, depth)) {
+							parent           = __co_container_of(coroutine->await, co_coroutine_obj_t, qe);
+							coroutine->await = NULL;
+							co_multi_co_wq_await_done(wq, parent);
+						}
+						if (co_rv == CO_RV_YIELD_BREAK)
+							co_multi_co_wq_detach(coroutine);
+						/* Last one of group wakes parent up */
+						joiner = co_rv == CO_RV_YIELD_BREAK ? co_multi_co_wq_group_done(coroutine) : NULL;
+						if (joiner && !parent && !coroutine->await && depth < CO_MULTI_CO_WQ_TRANSFER_DEPTH &&
+						    !co_is_terminated(joiner) && !co_routine_flag_test(joiner->flags, CO_FLAG_PAUSED)) {
+							parent = joiner;
+							joiner = NULL;
+						}
+						if (parent) { /* Resume the parent right away */
+							if (handed)
+								co_multi_co_wq_enq(wq, handed);
+							handed = NULL;
+							if (co_rv == CO_RV_YIELD_RETURN) {
+								handed = coroutine; /* Parent may await it again, then it runs right away too */
+							} else {
+								co_routine_flag_set_atomic(&coroutine->flags, CO_FLAG_TERM);
+								/* To be freed, after the group parent if it is due too */
+								co_multi_co_wq_enq_woken(wq, coroutine, joiner,
+								                         !co_routine_flag_test(coroutine->flags, CO_FLAG_INPLACE));
+							}
+							co_dbg_trace("Coroutine <%s> hands over to parent\n", coroutine->func_name);
+							coroutine = parent;
+							task      = &parent->qe;
+							++depth;
+							goto run;
 						}
-						co_q_enq(&wq->execq, task);     /* Reschedule itself */
 						if (co_rv == CO_RV_YIELD_BREAK) /* If needed mark for erase */
-							co_routine_flag_set(&coroutine->flags, CO_FLAG_TERM);
+							co_routine_flag_set_atomic(&coroutine->flags, CO_FLAG_TERM);
+						/* If it is a child coroutine, reschedule its parents. Then reschedule itself behind them,
+						 * or have it freed, unless in place - owner may reuse it right away */
+						co_multi_co_wq_enq_woken(wq, coroutine, joiner,
+						                         co_rv == CO_RV_YIELD_RETURN ||
+						                             !co_routine_flag_test(coroutine->flags, CO_FLAG_INPLACE));
 						goto break_loop;
 					case CO_RV_YIELD_AWAIT:
+						/* Awaits the child that handed over, let it run right away */
+						if (handed && handed->await == task && depth < CO_MULTI_CO_WQ_TRANSFER_DEPTH &&
+						    !co_routine_flag_test(handed->flags, CO_FLAG_PAUSED)) {
+							co_dbg_trace("Coroutine <%s> hands back to child\n", coroutine->func_name);
+							coroutine = handed;
+							task      = &handed->qe;
+							handed    = NULL;
+							++depth;
+							goto run;
+						}
+						/* Fall through */
+					case CO_RV_YIELD_PARK:
 						/* Do nothing, not my responsibility now */
 						goto break_loop;
 					case CO_RV_YIELD_COND_WAIT:
-						co_q_enq(&wq->execq, task); /* Simply reschedule to re-test later, try next task */
+						co_multi_co_wq_enq(wq, coroutine); /* Simply reschedule to re-test later, try next task */
 						/* Do not reset b4sleep */
 						break;
 					case CO_RV_YIELD_ERROR:
 						co_assert(0, "Unexpected error returned from coroutine\n");
 						break;
 				}
+				if (handed) {
+					co_multi_co_wq_enq(wq, handed);
+					handed = NULL;
+				}
 			}
 
 		break_loop:
+			if (handed) /* Hand over chain ended, child goes to execq as usual */
+				co_multi_co_wq_enq(wq, handed);
+
+			/* 2. Take new inputs every turn, a bounded batch, so that neither inputs nor running work starve */
+			co_multi_co_wq_inputq_drain(&wq->inputq, &inputs, CO_MULTI_CO_WQ_INPUT_BATCH);
+			if (inputs.count) {
+				co_multi_co_wq_enq_q(wq, &inputs); /* Each at its own level */
+				if (i >= initial_size)
+					break; /* Don't continue any further - analyze what we have */
+			}
 
-			/* Do not continue to read input if we may have more stuff to do */
+			/* Do not continue to look for work if we may have more stuff to do */
 			if (i < initial_size) {
 				b4sleep = 0;
 				break;
 			}
-			/* Else - done nothing this turn, try new inputs */
+			/* Else - done nothing this turn, check file descriptors */
+			if (co_multi_co_wq_poll(wq, NULL) > 0)
+				break;
 
-			/* 2. Now the input queue */ {
-				co_list_e_t *task = co_multi_src_q_peek(&wq->inputq);
-				if (task) {
-					co_multi_src_q_deq(&wq->inputq);
-					co_q_enq(&wq->execq, task);
-					break; /* Don't continue any further - analyze what we have */
-				}
+			/* 3. If we are here - we found nothing, ask siblings if any */
+			if (wq->share && wq->share->steal(wq->share, wq)) {
+				b4sleep = 0;
+				break;
 			}
 
-			/* 3. If we are here - we found nothing */
-			if (!b4sleep) {
+			/* 4. Nothing at all */
+			if (!b4sleep && !co_multi_co_wq_bell_cheap) {
 				co_dbg_trace("Work queue <%p> is feeling sleepy\n", wq);
 				b4sleep = 1;
 				co_atom_set(&wq->bell.wake_me_up, 1); /* Warn everyone we are going to sleep soon */
@@ -199,10 +1326,14 @@ static __inline__ co_errno_t co_multi_co_wq_loop(co_multi_co_wq_t *wq) {
 				/* Go to sleep */
 				co_errno_t err;
 				co_dbg_trace("Work queue <%p> is going to sleep\n", wq);
-				err = co_completion_timedwait(&wq->bell.bell, &wq->next_wakeup);
-				(void)err;
-				co_assert(!err || err == EINVAL || err == ETIMEDOUT,
-				          "Unexpected error while during completion wait %d\n", err);
+				co_multi_co_wq_arm_timers(wq);
+				if (co_multi_co_wq_poll_io(wq)) { /* Last chance, also flushes submissions */
+					b4sleep = 0;
+					break;
+				}
+				err = co_multi_co_wq_poll(wq, &wq->next_wakeup);
+				err = err < 0 ? -err : 0;
+				co_assert(!err || err == EINVAL, "Unexpected error while during completion wait %d\n", err);
 				co_dbg_trace("Work queue <%p> is awake\n", wq);
 				/* Good morning beautiful */
 				if (co_time_passed(&wq->next_wakeup))
@@ -219,18 +1350,10 @@ static __inline__ co_errno_t co_multi_co_wq_loop(co_multi_co_wq_t *wq) {
  * @param co Coroutine work queue pointer
  */
 void static __inline__ co_multi_co_wq_ring_the_bell(co_multi_co_wq_t *wq) {
-	if (co_atom_cmpxchg(&wq->bell.wake_me_up, 1, 0) == 1)
-		co_completion_done(&wq->bell.bell);
-}
-
-/**
- * Set wake up time for main loop
- * @param co Coroutine work queue pointer
- * @param wakeup Absolute time to wake up
- */
-void static __inline __co_adjust_wake_up(co_multi_co_wq_t *wq, const co_abstime_t *wakeup) {
-	if (co_is_invalid_abstime(&wq->next_wakeup) || co_get_time_ge(&wq->next_wakeup, wakeup))
-		wq->next_wakeup = *wakeup;
+	if (co_multi_co_wq_bell_cheap) /* Bell latches the ring itself, no need for warning handshake */
+		co_multi_co_wq_bell_done(&wq->bell.bell);
+	else if (co_atom_cmpxchg(&wq->bell.wake_me_up, 1, 0) == 1)
+		co_multi_co_wq_bell_done(&wq->bell.bell);
 }
 
 #endif /*CO_MULTI_CO_WQ_H*/
\ No newline at end of file
@@ -92,8 +92,12 @@ static __inline__ co_errno_t co_multi_src_q_init(co_multi_src_q_t *q, co_size_t
  * @param q Output queue
  */
 static __inline__ void co_multi_src_q_destroy(co_multi_src_q_t *q) {
+#ifndef CO_MULTI_SRC_STATIC_SIZED
 	co_atom_free(q->locks);
 	co_free(q->iqs);
+#else
+	(void)q;
+#endif
 }
 
 /**
@@ -113,12 +117,37 @@ static __inline__ co_list_e_t *co_multi_src_q_peek(co_multi_src_q_t *q) {
 			co_atom_xchg_unlock(&q->locks[q->iqi]);
 			return co_multi_src_q_peek(q); /* Now we have something in mq for sure */
 		}
-		if (++q->iqi > co_multi_src_q_sz(q))
+		if (++q->iqi >= co_multi_src_q_sz(q))
 				q->iqi = 0;
 	}
 	return NULL;
 }
 
+/**
+ * Move queued elements to another queue, whole input queues at a time
+ * Input queues are visited round robin, starting where the previous call stopped,
+ * so that no producer is favoured.
+ * @param q Multi source queue pointer
+ * @param dst Destination queue
+ * @param max Stop taking input queues once at least this many elements were moved
+ * @return Number of elements moved
+ */
+static __inline__ co_size_t co_multi_src_q_drain(co_multi_src_q_t *q, co_queue_t *dst, co_size_t max) {
+	co_size_t moved = q->mq.count;
+	int i;
+	co_q_enq_q(dst, &q->mq);
+	for (i = 0; i < co_multi_src_q_sz(q) && moved < max; ++i) {
+		if (!co_q_empty(&q->iqs[q->iqi]) && !co_atom_xchg(&q->locks[q->iqi], 1)) {
+			moved += q->iqs[q->iqi].count;
+			co_q_enq_q(dst, &q->iqs[q->iqi]);
+			co_atom_xchg_unlock(&q->locks[q->iqi]);
+		}
+		if (++q->iqi >= co_multi_src_q_sz(q))
+			q->iqi = 0;
+	}
+	return moved;
+}
+
 /**
  * Remove first element from queue
  * Assumes queue is not empty. Check it before calling.
@@ -147,7 +176,7 @@ static __inline__ co_errno_t co_multi_src_q_enq(co_multi_src_q_t *q, co_list_e_t
 			co_atom_xchg_unlock(&q->locks[lockid]);
 			return 0; /* Done */
 		}
-		if (++lockid > co_multi_src_q_sz(q))
+		if (++lockid >= co_multi_src_q_sz(q))
 			lockid = 0;
 	}
 	return -EAGAIN; /* Could not aquire iq. Very low probability, but still. Can try again. */
@@ -0,0 +1,102 @@
+#ifndef CO_PROMISE_H
+#define CO_PROMISE_H
+/**
+ * @file co_promise.h
+ *
+ * Promise, a single value handed to a coroutine by anyone, typically a foreign thread
+ * or a callback of a C library.
+ *
+ * Coroutine awaits the promise, and is parked off execq until it is set. Setter
+ * publishes the value and the state with a single exchange, and if the coroutine is
+ * already parked, queues it to the input queue of its work queue. A promise set before
+ * it is awaited costs the coroutine no yield at all.
+ *
+ * A promise is set once, and awaited by a single coroutine.
+ *
+ */
+
+#include "co_coroutines.h"
+#include "dep/co_atomics.h"
+#include "dep/co_types.h"
+
+/**
+ * Promise states
+ */
+typedef enum co_promise_state {
+	/** Neither set nor awaited */
+	CO_PROMISE_EMPTY,
+	/** Coroutine is parked on it */
+	CO_PROMISE_AWAITED,
+	/** Value is set */
+	CO_PROMISE_SET,
+} co_promise_state_t;
+
+/**
+ * Promise object
+ */
+typedef struct co_promise {
+	/** See co_promise_state_t */
+	co_atom_t state;
+	/** Awaiting coroutine */
+	co_coroutine_obj_t *waiter;
+	/** Value, valid once set */
+	void *value;
+} co_promise_t;
+
+/**
+ * Initializer of promise, empty
+ */
+#define co_promise_init()                                                                                              \
+	(co_promise_t) { co_atom_init(CO_PROMISE_EMPTY), NULL, NULL }
+
+/**
+ * Set promise value, from any thread
+ * Promise must not be touched afterwards, the coroutine may be gone with it.
+ * @param p Promise pointer
+ * @param value Value
+ */
+static __inline__ void co_promise_set(co_promise_t *p, void *value) {
+	co_coroutine_obj_t *waiter;
+	p->value = value;
+	if (co_atom_xchg(&p->state, CO_PROMISE_SET) == CO_PROMISE_AWAITED) {
+		waiter = p->waiter;
+		co_multi_co_wq_wake(waiter->wq, waiter);
+	}
+}
+
+/**
+ * Test whether promise is set
+ * @param p Promise pointer
+ */
+#define co_promise_is_set(p) (__atomic_load_n(&(p)->state.counter, __ATOMIC_ACQUIRE) == CO_PROMISE_SET)
+
+/**
+ * Promise value, once set
+ * @param p Promise pointer
+ */
+#define co_promise_value(p) ((p)->value)
+
+/**
+ * Register coroutine as the waiter of promise, unless it is set already
+ * @return 1 if coroutine is to park, 0 if promise is set
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_promise_wait(co_promise_t *p, co_coroutine_obj_t *co) {
+	if (co_promise_is_set(p))
+		return 0;
+	p->waiter = co;
+	return co_atom_cmpxchg(&p->state, CO_PROMISE_EMPTY, CO_PROMISE_AWAITED) == CO_PROMISE_EMPTY;
+}
+
+/**
+ * Yield coroutine and park it until promise is set, unless it is set already
+ * Value is then found by co_promise_value.
+ * @param self Calling coroutine
+ * @param p Promise pointer, in args or locals of caller
+ */
+#define co_yield_await_promise(self, p)                                                                                \
+	if (__co_promise_wait(p, &(self)->obj)) {                                                                          \
+		co_yield_park(self);                                                                                           \
+	}
+
+#endif /*CO_PROMISE_H*/
@@ -0,0 +1,255 @@
+#ifndef CO_RUNTIME_H
+#define CO_RUNTIME_H
+/**
+ * @file co_runtime.h
+ *
+ * Multi worker runtime
+ *
+ * Owns N work queues, each one looped by its own worker thread, and balances
+ * runnable coroutines between them.
+ *
+ * The idea:
+ *    Execution queue of a work queue is strictly single threaded, nobody but the
+ *    owner may touch it. So instead of letting siblings dig into it, an idle worker
+ *    announces it is hungry. A busy worker, when it dequeues a coroutine that may
+ *    migrate (see co_is_migratable), and has more work behind it, puts it into its
+ *    steal queue, and wakes one of the hungry. The hungry ones drain the steal queues
+ *    of siblings (guarded by xchg flag, same as multi source queue) into their own execq.
+ *    A worker that has work again stops being hungry, and takes back offers nobody came
+ *    for once no one is hungry anymore.
+ *
+ *    Only coroutines that did not start yet migrate. Anything that was already
+ *    running may be a part of await chain, or own children on its work queue,
+ *    and `co_run` requires all of them to share a work queue.
+ *
+ */
+
+#include "co_multi_co_wq.h"
+#include "dep/co_alloc.h"
+#include "dep/co_atomics.h"
+#include "dep/co_list.h"
+#include "dep/co_sync.h"
+#include "dep/co_types.h"
+#include "utils/co_macro.h"
+
+/**
+ * Single runtime worker
+ */
+typedef struct co_runtime_worker {
+	/** Work queue of the worker */
+	co_multi_co_wq_t wq;
+	/** Guard of stealq */
+	co_atom_t lock;
+	/** Coroutines offered to siblings */
+	co_queue_t stealq;
+	/** Indication that worker ran out of work and waits for offers */
+	co_atom_t hungry;
+	/** Worker thread */
+	pthread_t thread;
+} co_runtime_worker_t;
+
+/**
+ * The runtime object
+ */
+typedef struct co_runtime {
+	/** Work sharing group of all the workers */
+	co_multi_co_wq_share_t share;
+	/** Workers array */
+	co_runtime_worker_t *workers;
+	/** Number of workers */
+	co_size_t n;
+	/** Round robin counter to distribute new coroutines */
+	co_atom_t next;
+} co_runtime_t;
+
+#define co_runtime_from_share(s) __co_container_of(s, co_runtime_t, share)
+#define co_runtime_worker_from_wq(w) __co_container_of(w, co_runtime_worker_t, wq)
+
+/**
+ * Offer hook: put coroutine in own steal queue and wake up one hungry sibling
+ */
+static co_errno_t co_runtime_offer(co_multi_co_wq_share_t *share, co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	co_runtime_t *rt          = co_runtime_from_share(share);
+	co_runtime_worker_t *self = co_runtime_worker_from_wq(wq);
+	co_size_t i;
+
+	/* Enough already waits to be taken */
+	if (self->stealq.count >= co_atom_peek(&share->hungry))
+		return -EBUSY;
+	if (co_atom_xchg(&self->lock, 1))
+		return -EBUSY; /* Someone is stealing right now, no point to wait */
+	co_q_enq(&self->stealq, &co->qe);
+	co_atom_xchg_unlock(&self->lock);
+
+	/* Wake up someone to take it */
+	for (i = 0; i < rt->n; ++i) {
+		co_runtime_worker_t *w = &rt->workers[i];
+		if (w == self)
+			continue; /* May still be flagged, if got work without stealing */
+		if (co_atom_peek(&w->hungry) && co_atom_cmpxchg(&w->hungry, 1, 0) == 1) {
+			co_atom_sub(&share->hungry, 1);
+			co_multi_co_wq_ring_the_bell(&w->wq);
+			break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Steal hook: take everything from the first non empty sibling steal queue
+ */
+static co_size_t co_runtime_steal(co_multi_co_wq_share_t *share, co_multi_co_wq_t *wq) {
+	co_runtime_t *rt          = co_runtime_from_share(share);
+	co_runtime_worker_t *self = co_runtime_worker_from_wq(wq);
+	co_size_t i, id = self - rt->workers;
+
+	for (i = 0; i < rt->n; ++i) {
+		co_runtime_worker_t *w = &rt->workers[(id + i) % rt->n];
+		co_queue_t loot;
+		co_list_e_t *e;
+		co_size_t taken;
+		if (co_q_empty(&w->stealq) || co_atom_xchg(&w->lock, 1))
+			continue;
+		loot      = w->stealq;
+		w->stealq = co_q_init();
+		co_atom_xchg_unlock(&w->lock);
+		if (co_q_empty(&loot))
+			continue;
+		for_each_co_list(e, loot.head) { __co_container_of(e, co_coroutine_obj_t, qe)->wq = wq; }
+		taken = loot.count;
+		co_multi_co_wq_enq_q(wq, &loot);
+		/* Fed, stop asking for offers */
+		if (co_atom_xchg(&self->hungry, 0))
+			co_atom_sub(&share->hungry, 1);
+		co_dbg_trace("Work queue <%p> stole %u coroutines from <%p>\n", wq, taken, &w->wq);
+		return taken;
+	}
+
+	/* Nothing to steal, let the busy ones know */
+	if (!co_atom_xchg(&self->hungry, 1))
+		co_atom_add(&share->hungry, 1);
+	return 0;
+}
+
+/**
+ * Busy hook: stop asking for offers, and take back own offers once nobody is hungry
+ */
+static void co_runtime_busy(co_multi_co_wq_share_t *share, co_multi_co_wq_t *wq) {
+	co_runtime_worker_t *self = co_runtime_worker_from_wq(wq);
+	co_queue_t loot;
+
+	if (co_atom_peek(&self->hungry) && co_atom_xchg(&self->hungry, 0))
+		co_atom_sub(&share->hungry, 1);
+	if (co_q_empty(&self->stealq) || co_atom_peek(&share->hungry) || co_atom_xchg(&self->lock, 1))
+		return;
+	loot         = self->stealq;
+	self->stealq = co_q_init();
+	co_atom_xchg_unlock(&self->lock);
+	co_multi_co_wq_enq_q(wq, &loot);
+}
+
+/**
+ * Initialize runtime
+ * @param rt Runtime pointer
+ * @param n Number of workers
+ * @param size Size of multi queue to use for input of each work queue
+ * @param fast_alloc Array of n fast allocators, one per worker
+ * @param slow_alloc Slow allocator, shared by all workers
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_runtime_init(co_runtime_t *rt, co_size_t n, co_size_t size,
+                                             co_allocator_t *const *fast_alloc, co_allocator_t *slow_alloc) {
+	co_size_t i;
+	co_errno_t rv;
+
+	*rt = (co_runtime_t){.share = {.hungry = co_atom_init(0),
+	                               .offer  = co_runtime_offer,
+	                               .steal  = co_runtime_steal,
+	                               .busy   = co_runtime_busy},
+	                     .n     = n,
+	                     .next  = co_atom_init(0)};
+	if ((rt->workers = co_malloc_memalign(64, n * sizeof(co_runtime_worker_t))) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < n; ++i) {
+		co_runtime_worker_t *w = &rt->workers[i];
+		if ((rv = co_multi_co_wq_init(&w->wq, size, fast_alloc[i], slow_alloc)) != 0) {
+			while (i--)
+				co_multi_co_wq_destroy(&rt->workers[i].wq);
+			co_free(rt->workers);
+			return rv;
+		}
+		w->wq.share = &rt->share;
+		w->lock     = co_atom_init(0);
+		w->stealq   = co_q_init();
+		w->hungry   = co_atom_init(0);
+	}
+	return 0;
+}
+
+static void *co_runtime_worker_main(void *param) {
+	co_multi_co_wq_loop(&((co_runtime_worker_t *)param)->wq);
+	return NULL;
+}
+
+/**
+ * Start all worker threads
+ * @param rt Runtime pointer
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_runtime_start(co_runtime_t *rt) {
+	co_size_t i;
+	for (i = 0; i < rt->n; ++i) {
+		co_errno_t rv = pthread_create(&rt->workers[i].thread, NULL, co_runtime_worker_main, &rt->workers[i]);
+		if (rv) {
+			while (i--) {
+				rt->workers[i].wq.terminate = 1;
+				co_multi_co_wq_ring_the_bell(&rt->workers[i].wq);
+				pthread_join(rt->workers[i].thread, NULL);
+			}
+			return rv;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Stop all worker threads and wait for them to exit
+ * Coroutines that did not finish stay in their work queues until destroy.
+ * @param rt Runtime pointer
+ */
+static __inline__ void co_runtime_stop(co_runtime_t *rt) {
+	co_size_t i;
+	for (i = 0; i < rt->n; ++i) {
+		rt->workers[i].wq.terminate = 1;
+		co_multi_co_wq_ring_the_bell(&rt->workers[i].wq);
+	}
+	for (i = 0; i < rt->n; ++i)
+		pthread_join(rt->workers[i].thread, NULL);
+}
+
+/**
+ * Destroy runtime
+ * Deallocate all coroutines left in it. Must be stopped before that.
+ * @param rt Runtime pointer
+ */
+static __inline__ void co_runtime_destroy(co_runtime_t *rt) {
+	co_size_t i;
+	for (i = 0; i < rt->n; ++i) {
+		co_runtime_worker_t *w = &rt->workers[i];
+		co_multi_co_wq_enq_q(&w->wq, &w->stealq); /* Let wq free those as well */
+		co_multi_co_wq_destroy(&w->wq);
+	}
+	co_free(rt->workers);
+}
+
+/**
+ * Pick a work queue for a new coroutine
+ * Work queues are picked in round robin, balancing is done by workers later on.
+ * @param rt Runtime pointer
+ * @return Work queue pointer
+ */
+static __inline__ co_multi_co_wq_t *co_runtime_wq(co_runtime_t *rt) {
+	return &rt->workers[(unsigned)co_atom_add(&rt->next, 1) % rt->n].wq;
+}
+
+#endif /*CO_RUNTIME_H*/
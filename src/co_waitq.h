@@ -0,0 +1,176 @@
+#ifndef CO_WAITQ_H
+#define CO_WAITQ_H
+/**
+ * @file co_waitq.h
+ *
+ * Wait queue
+ *
+ * A place for coroutines to park on, off the execution queue, until someone
+ * explicitly wakes them up. Parked coroutines cost nothing to the work queue loop.
+ *
+ * Wake ups can come from any thread. A waiter is returned either directly to the
+ * execq, when woken by a coroutine of the same work queue, or through the input
+ * queue of its work queue otherwise.
+ *
+ * Queue itself is guarded by a spin lock, held only to link or unlink coroutines.
+ *
+ */
+
+#include "co_coroutines.h"
+#include "dep/co_atomics.h"
+#include "dep/co_list.h"
+#include "dep/co_sync.h"
+
+/**
+ * Wait queue object
+ */
+typedef struct co_waitq {
+	/** Guard of q */
+	co_atom_t lock;
+	/** Parked coroutines */
+	co_queue_t q;
+} co_waitq_t;
+
+#define co_waitq_init()                                                                                                \
+	(co_waitq_t) { co_atom_init(0), co_q_init() }
+
+/**
+ * Park coroutine on wait queue, unless condition is already fulfilled
+ * Condition is tested under the wait queue lock, so a waker that fulfills it
+ * before waking up cannot be missed.
+ * @note Internal
+ */
+#define __co_waitq_park_unless(waitq, co, cond)                                                                        \
+	({                                                                                                                 \
+		co_bool_t __co_parked = 0;                                                                                     \
+		co_spin_lock(&(waitq)->lock);                                                                                  \
+		if (!(cond)) {                                                                                                 \
+			co_q_enq(&(waitq)->q, &(co)->qe);                                                                          \
+			__co_parked = 1;                                                                                           \
+		}                                                                                                              \
+		co_spin_unlock(&(waitq)->lock);                                                                                \
+		__co_parked;                                                                                                   \
+	})
+
+/**
+ * Take first waiter out of wait queue
+ * @note Internal
+ */
+static __inline__ co_coroutine_obj_t *__co_waitq_take_one(co_waitq_t *waitq) {
+	co_list_e_t *e;
+	co_spin_lock(&waitq->lock);
+	if ((e = co_q_peek(&waitq->q)) != NULL)
+		co_q_deq(&waitq->q);
+	co_spin_unlock(&waitq->lock);
+	return e ? __co_container_of(e, co_coroutine_obj_t, qe) : NULL;
+}
+
+/**
+ * Take all waiters out of wait queue
+ * @note Internal
+ */
+static __inline__ co_queue_t __co_waitq_take_all(co_waitq_t *waitq) {
+	co_queue_t all;
+	co_spin_lock(&waitq->lock);
+	all       = waitq->q;
+	waitq->q  = co_q_init();
+	co_spin_unlock(&waitq->lock);
+	return all;
+}
+
+/**
+ * Reschedule woken up coroutine
+ * @param wq Work queue of the waker, or NULL if waker is not a coroutine
+ * @note Internal
+ */
+static __inline__ void __co_waitq_resume(co_multi_co_wq_t *wq, co_coroutine_obj_t *co) {
+	if (co->wq == wq)
+		co_multi_co_wq_enq(wq, co); /* Same thread, no need to bother input queue */
+	else
+		co_multi_co_wq_wake(co->wq, co);
+}
+
+/**
+ * Wake up the first coroutine parked on wait queue, from any context
+ * @param waitq Wait queue pointer
+ * @return 1 if a coroutine was woken up, else 0
+ */
+static __inline__ co_bool_t co_waitq_wake_one(co_waitq_t *waitq) {
+	co_coroutine_obj_t *co = __co_waitq_take_one(waitq);
+	if (co)
+		co_multi_co_wq_wake(co->wq, co);
+	return co != NULL;
+}
+
+/**
+ * Wake up all coroutines parked on wait queue, from any context
+ * @param waitq Wait queue pointer
+ * @return Number of coroutines woken up
+ */
+static __inline__ co_size_t co_waitq_wake_all(co_waitq_t *waitq) {
+	co_queue_t all = __co_waitq_take_all(waitq);
+	co_size_t n    = all.count;
+	co_list_e_t *e;
+	for_each_drain_queue(e, &all, co_q_peek, co_q_deq) {
+		co_coroutine_obj_t *co = __co_container_of(e, co_coroutine_obj_t, qe);
+		co_multi_co_wq_wake(co->wq, co);
+	}
+	return n;
+}
+
+/**
+ * Wake up the first coroutine parked on wait queue, from coroutine context
+ * @param self Calling coroutine
+ * @param waitq Wait queue pointer
+ * @return 1 if a coroutine was woken up, else 0
+ */
+#define co_wake_one(self, waitq)                                                                                       \
+	({                                                                                                                 \
+		co_coroutine_obj_t *__co_waiter = __co_waitq_take_one(waitq);                                                  \
+		if (__co_waiter)                                                                                               \
+			__co_waitq_resume((self)->obj.wq, __co_waiter);                                                            \
+		__co_waiter != NULL;                                                                                           \
+	})
+
+/**
+ * Wake up all coroutines parked on wait queue, from coroutine context
+ * @param self Calling coroutine
+ * @param waitq Wait queue pointer
+ * @return Number of coroutines woken up
+ */
+#define co_wake_all(self, waitq)                                                                                       \
+	({                                                                                                                 \
+		co_queue_t __co_waiters = __co_waitq_take_all(waitq);                                                          \
+		co_size_t __co_n        = __co_waiters.count;                                                                  \
+		co_list_e_t *__co_e;                                                                                           \
+		for_each_drain_queue(__co_e, &__co_waiters, co_q_peek, co_q_deq) {                                            \
+			__co_waitq_resume((self)->obj.wq, __co_container_of(__co_e, co_coroutine_obj_t, qe));                      \
+		}                                                                                                              \
+		__co_n;                                                                                                        \
+	})
+
+/**
+ * Yield coroutine and park it on wait queue until woken up
+ * @param self Calling coroutine
+ * @param waitq Wait queue pointer
+ */
+#define co_yield_wait_queue(self, waitq)                                                                               \
+	{                                                                                                                  \
+		__co_waitq_park_unless(waitq, &(self)->obj, 0);                                                                \
+		co_yield_park(self);                                                                                           \
+	}
+
+/**
+ * Yield coroutine and park it on wait queue until condition is fulfilled
+ * Condition is re-tested only when coroutine is woken up, so whoever fulfills it
+ * must wake up the wait queue afterwards.
+ * @param self Calling coroutine
+ * @param waitq Wait queue pointer
+ * @param cond Condition to wait for
+ */
+#define co_yield_wait_queue_cond(self, waitq, cond)                                                                    \
+	while (__co_waitq_park_unless(waitq, &(self)->obj, cond)) {                                                        \
+		co_yield_park(self);                                                                                           \
+	}
+
+#endif /*CO_WAITQ_H*/
@@ -1,13 +1,14 @@
 #include "co_coroutines.h"
 #include "co_shortcuts.h"
-#include "dep/co_primitive_allocator.h"
+#include "dep/co_slab_allocator.h"
+#include "dep/co_tcache_allocator.h"
 #include "dep/co_timeout.h"
 #include <stdio.h>
 #include <unistd.h>
 
 /* Sample 1 */
 co_routine_decl(int, fibonacci_producer, int, x, int, y);
-co_routine_decl(/*void*/, fibonacci_printer, struct fibonacci_producer_co_obj *, producer);
+co_routine_decl(/*void*/, fibonacci_printer, struct fibonacci_producer_co_obj, producer); /* Child lives in place */
 
 co_yield_rv_t fibonacci_producer(struct fibonacci_producer_co_obj *self) {
 	co_routine_begin(self, fibonacci_producer);
@@ -21,18 +22,18 @@ co_yield_rv_t fibonacci_producer(struct fibonacci_producer_co_obj *self) {
 
 co_yield_rv_t fibonacci_printer(struct fibonacci_printer_co_obj *self) {
 	co_routine_begin(self, fibonacci_printer);
-	_(producer) = co_fork_run(self, fibonacci_producer, 0, 1);
-	while_co_yield_await(self, _(producer)) {
-		printf("Got result from fibonacci producer: %d\n", _(producer)->rv);
-		if (_(producer)->rv > 100) {
+	co_fork_run_inplace(self, &_(producer), fibonacci_producer, 0, 1);
+	while_co_yield_await(self, &_(producer)) {
+		printf("Got result from fibonacci producer: %d\n", _(producer).rv);
+		if (_(producer).rv > 100) {
 			printf("Got enough fibonacci numbers.\n");
 			break;
 		}
-		co_pause(self, _(producer));
+		co_pause(self, &_(producer));
 		co_yield_wait_timeout(self, 1000000000UL);
-		co_run(self, _(producer));
+		co_run(self, &_(producer));
 	}
-	co_force_terminate(&_(producer)->obj);
+	co_force_terminate(&_(producer).obj);
 	co_yield_break();
 }
 
@@ -95,12 +96,15 @@ void *async_co_scheduler(void *param) {
 }
 
 int main() {
-	co_allocator_t a = co_primitive_allocator_init();
+	co_tcache_allocator_t tcache;
+	co_slab_allocator_t slab;
 	co_multi_co_wq_t wq;
 	struct fibonacci_printer_co_obj *fp;
 	pthread_t sched;
 
-	co_multi_co_wq_init(&wq, 8, &a, &a);
+	co_tcache_allocator_init(&tcache);
+	co_slab_allocator_init(&slab);
+	co_multi_co_wq_init(&wq, 8, &slab.base, &tcache.base);
 
 	fp = co_new(&wq, fibonacci_printer);
 
@@ -113,7 +117,9 @@ int main() {
 
 	/* Cleanup */
 	co_multi_co_wq_destroy(&wq);
+	co_slab_allocator_destroy(&slab);
 	pthread_join(sched, NULL);
+	co_tcache_allocator_destroy(&tcache);
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,196 @@
+#ifndef CO_ARENA_H
+#define CO_ARENA_H
+/**
+ * @file co_arena.h
+ *
+ * Arena, a region of memory objects are bump allocated from, and released all at once.
+ *
+ * Not thread safe. Owned by a single thread at a time.
+ *
+ * The idea:
+ *    Memory is taken from a backing allocator in chunks. Objects are carved from the
+ *    current chunk by bumping a pointer, and are never freed one by one. Arena counts
+ *    live objects instead, and releases all chunks when the last one is put back.
+ *
+ *    Small objects put back are kept on free lists by size, and reused by the next
+ *    allocations of same size, so that a tree of objects that keeps replacing its
+ *    members stays in the same, cache hot, memory.
+ *
+ *    Arena may have an owner object, allocated first. While the owner is the only live
+ *    object, arena rewinds to right after it, so a long lived owner that keeps creating
+ *    short lived objects does not grow the arena forever.
+ *
+ *    Arena header lives in its first chunk.
+ *
+ */
+
+#include "co_allocator.h"
+#include "co_list.h"
+#include "co_types.h"
+
+/** Arena objects alignment */
+#define CO_ARENA_ALIGN (16)
+
+/** Number of object sizes reused, objects up to CO_ARENA_RECYCLE * CO_ARENA_ALIGN bytes are */
+#ifndef CO_ARENA_RECYCLE
+#	define CO_ARENA_RECYCLE (32)
+#endif
+
+#define __co_arena_round(s) (((s) + CO_ARENA_ALIGN - 1) & ~(co_size_t)(CO_ARENA_ALIGN - 1))
+
+/**
+ * Chunk header
+ */
+typedef struct co_arena_chunk {
+	/** Previous chunk, first one has none */
+	struct co_arena_chunk *next;
+	/** Total size of chunk */
+	co_size_t size;
+} __attribute__((aligned(CO_ARENA_ALIGN))) co_arena_chunk_t;
+
+/**
+ * Arena object
+ */
+typedef struct co_arena {
+	/** Backing allocator */
+	co_allocator_t *alloc;
+	/** Chunks, current one first */
+	co_arena_chunk_t *chunks;
+	/** Free space of current chunk */
+	char *cur, *end;
+	/** Size of chunks taken when current one runs out */
+	co_size_t chunk_size;
+	/** Objects allocated and not put back yet */
+	co_size_t live;
+	/** Owner object, or NULL */
+	void *owner;
+	/** Rewind position, right after the owner */
+	char *mark;
+	/** Objects put back, by size, index 0 unused */
+	co_list_e_t *free[CO_ARENA_RECYCLE + 1];
+} __attribute__((aligned(CO_ARENA_ALIGN))) co_arena_t;
+
+/**
+ * Create arena
+ * @param alloc Backing allocator
+ * @param chunk_size Size of chunks, first one included
+ * @return Arena pointer or NULL
+ */
+static __inline__ co_arena_t *co_arena_create(co_allocator_t *alloc, co_size_t chunk_size) {
+	co_arena_chunk_t *chunk;
+	co_arena_t *arena;
+	co_size_t i;
+	if (chunk_size < sizeof(*chunk) + sizeof(*arena) + CO_ARENA_ALIGN)
+		chunk_size = sizeof(*chunk) + sizeof(*arena) + CO_ARENA_ALIGN;
+	if ((chunk = alloc->alloc(alloc, chunk_size)) == NULL)
+		return NULL;
+	chunk->next = NULL;
+	chunk->size = chunk_size;
+
+	arena             = (co_arena_t *)(chunk + 1);
+	arena->alloc      = alloc;
+	arena->chunks     = chunk;
+	arena->cur        = (char *)(arena + 1);
+	arena->end        = (char *)chunk + chunk_size;
+	arena->chunk_size = chunk_size;
+	arena->live       = 0;
+	arena->owner      = NULL;
+	arena->mark       = NULL;
+	for (i = 0; i <= CO_ARENA_RECYCLE; ++i)
+		arena->free[i] = NULL;
+	return arena;
+}
+
+/**
+ * Destroy arena, releasing all its memory, whatever the live objects
+ * @param arena Arena pointer
+ */
+static __inline__ void co_arena_destroy(co_arena_t *arena) {
+	co_allocator_t *alloc   = arena->alloc;
+	co_arena_chunk_t *chunk = arena->chunks, *next;
+	for (; chunk; chunk = next) { /* Arena header is in the last one */
+		next = chunk->next;
+		alloc->free(alloc, chunk);
+	}
+}
+
+/**
+ * Allocate object from arena
+ * @param arena Arena pointer
+ * @param s Object size
+ * @return Object pointer or NULL
+ */
+static __inline__ void *co_arena_alloc(co_arena_t *arena, co_size_t s) {
+	co_size_t cls = (s + CO_ARENA_ALIGN - 1) / CO_ARENA_ALIGN;
+	char *obj;
+	if (cls && cls <= CO_ARENA_RECYCLE && arena->free[cls]) {
+		obj              = (char *)arena->free[cls];
+		arena->free[cls] = arena->free[cls]->next;
+		++arena->live;
+		return obj;
+	}
+	s = __co_arena_round(s);
+	if ((co_size_t)(arena->end - arena->cur) < s) {
+		co_size_t size = sizeof(co_arena_chunk_t) + s > arena->chunk_size ? sizeof(co_arena_chunk_t) + s
+		                                                                   : arena->chunk_size;
+		co_arena_chunk_t *chunk = arena->alloc->alloc(arena->alloc, size);
+		if (!chunk)
+			return NULL;
+		chunk->next   = arena->chunks;
+		chunk->size   = size;
+		arena->chunks = chunk;
+		arena->cur    = (char *)(chunk + 1);
+		arena->end    = (char *)chunk + size;
+	}
+	obj = arena->cur;
+	arena->cur += s;
+	++arena->live;
+	return obj;
+}
+
+#define __co_arena_in_chunk(chunk, p) ((char *)(p) > (char *)(chunk) && (char *)(p) <= (char *)(chunk) + (chunk)->size)
+
+/**
+ * Make object the owner of arena
+ * Must be the last object allocated.
+ * @param arena Arena pointer
+ * @param owner Object pointer
+ */
+static __inline__ void co_arena_set_owner(co_arena_t *arena, void *owner) {
+	arena->owner = owner;
+	arena->mark  = arena->cur;
+}
+
+/**
+ * Put object back
+ * @param arena Arena pointer
+ * @param obj Object pointer
+ * @param s Object size, as allocated
+ * @return 1 if it was the last live object, and arena was destroyed, else 0
+ */
+static __inline__ co_bool_t co_arena_put(co_arena_t *arena, void *obj, co_size_t s) {
+	co_size_t cls = (s + CO_ARENA_ALIGN - 1) / CO_ARENA_ALIGN;
+	if (obj == arena->owner)
+		arena->owner = NULL;
+	if (--arena->live == 0) {
+		co_arena_destroy(arena);
+		return 1;
+	}
+	if (arena->live == 1 && arena->owner) { /* Owner alone, rewind */
+		for (cls = 0; cls <= CO_ARENA_RECYCLE; ++cls)
+			arena->free[cls] = NULL;
+		while (!__co_arena_in_chunk(arena->chunks, arena->mark)) {
+			co_arena_chunk_t *chunk = arena->chunks;
+			arena->chunks           = chunk->next;
+			arena->alloc->free(arena->alloc, chunk);
+		}
+		arena->cur = arena->mark;
+		arena->end = (char *)arena->chunks + arena->chunks->size;
+	} else if (cls && cls <= CO_ARENA_RECYCLE) {
+		((co_list_e_t *)obj)->next = arena->free[cls];
+		arena->free[cls]           = obj;
+	}
+	return 0;
+}
+
+#endif /*CO_ARENA_H*/
@@ -8,7 +8,7 @@
  */
 
 /* clang-format off */
-typedef struct { int counter; } co_atom_t __attribute__ ((aligned (32)));
+typedef struct { int counter; } __attribute__ ((aligned (32))) co_atom_t;
 
 #define co_atom_init(val)              (co_atom_t){ (val) }
 
@@ -19,8 +19,16 @@ typedef struct { int counter; } co_atom_t __attribute__ ((aligned (32)));
 #define co_atom_xchg(ptr, val)         __sync_lock_test_and_set(&(ptr)->counter, (val))
 #define co_atom_xchg_unlock(ptr)       __sync_lock_release(&(ptr)->counter)
 #define co_atom_cmpxchg(ptr, old, new) __sync_val_compare_and_swap(&(ptr)->counter, (old), (new))
-#define co_atom_read(ptr)              ({__sync_synchronize(); (ptr)->counter;});
+#define co_atom_read(ptr)              ({__sync_synchronize(); (ptr)->counter;})
+#define co_atom_peek(ptr)              (*(volatile int *)&(ptr)->counter)
 #define co_atom_set(ptr, val)          ({(ptr)->counter = (val); __sync_synchronize(); (val);})
+#define co_atom_add(ptr, val)          __sync_add_and_fetch(&(ptr)->counter, (val))
+#define co_atom_sub(ptr, val)          __sync_sub_and_fetch(&(ptr)->counter, (val))
+
+/* Same, for plain integer words shared between threads */
+#define co_word_cmpxchg(ptr, old, new) __sync_val_compare_and_swap((ptr), (old), (new))
+#define co_word_and(ptr, val)          __sync_fetch_and_and((ptr), (val))
+#define co_word_or(ptr, val)           __sync_fetch_and_or((ptr), (val))
 /* clang-format on */
 
 #endif /*DEP__CO_ATOMICS_H*/
\ No newline at end of file
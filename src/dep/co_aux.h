@@ -24,9 +24,24 @@ static __inline__ co_errno_t co_get_time_in_future(co_nanosec_t wait, co_abstime
 	}
 	res->tv_sec += (wait / 1000000000UL);
 	res->tv_nsec += (wait % 1000000000UL);
+	if (res->tv_nsec >= 1000000000L) {
+		res->tv_nsec -= 1000000000L;
+		++res->tv_sec;
+	}
 	return 0;
 }
 
+static __inline__ unsigned long long co_abstime_to_ns(const co_abstime_t *t) {
+	return (unsigned long long)t->tv_sec * 1000000000ULL + t->tv_nsec;
+}
+
+static __inline__ co_abstime_t co_ns_to_abstime(unsigned long long ns) {
+	co_abstime_t t;
+	t.tv_sec  = ns / 1000000000ULL;
+	t.tv_nsec = ns % 1000000000ULL;
+	return t;
+}
+
 static __inline__ co_bool_t co_get_time_ge(const co_abstime_t *t1, const co_abstime_t *t2) {
 	return (t1->tv_sec > t2->tv_sec || (t1->tv_sec == t2->tv_sec && t1->tv_nsec >= t2->tv_nsec));
 }
@@ -0,0 +1,157 @@
+#ifndef CO_EPOLL_H
+#define CO_EPOLL_H
+/**
+ * @file co_epoll.h
+ *
+ * Epoll based bell
+ *
+ * Same role as completion object, but sleeping is done in epoll_wait, so along
+ * with the bell (an eventfd) the sleeper is woken up by readiness of any watched
+ * file descriptor. Linux only.
+ *
+ */
+
+#include "co_aux.h"
+#include "co_dbg.h"
+#include "co_types.h"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * Epoll bell object
+ */
+typedef struct co_epoll {
+	/** Epoll instance */
+	int epfd;
+	/** Event fd used as the bell */
+	int evfd;
+} co_epoll_t;
+
+/**
+ * Initialize epoll bell.
+ * @param ep Epoll bell pointer
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_epoll_init(co_epoll_t *ep) {
+	struct epoll_event ev;
+	if ((ep->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return errno;
+	if ((ep->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		co_errno_t rv = errno;
+		close(ep->epfd);
+		return rv;
+	}
+	ev.events   = EPOLLIN;
+	ev.data.ptr = NULL; /* NULL is the bell */
+	if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, ep->evfd, &ev)) {
+		co_errno_t rv = errno;
+		close(ep->evfd);
+		close(ep->epfd);
+		return rv;
+	}
+	return 0;
+}
+
+/**
+ * Destroy epoll bell.
+ * @param ep Epoll bell pointer
+ */
+static __inline__ void co_epoll_destroy(co_epoll_t *ep) {
+	close(ep->evfd);
+	close(ep->epfd);
+}
+
+/**
+ * Ring the bell.
+ * @param ep Epoll bell pointer
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_epoll_done(co_epoll_t *ep) {
+	eventfd_t one = 1;
+	co_dbg_trace("set epoll bell\n");
+	return write(ep->evfd, &one, sizeof(one)) == sizeof(one) ? 0 : errno;
+}
+
+/**
+ * Watch file descriptor for a single event
+ * Watch is one shot, after fd is reported it must be watched again.
+ * @param ep Epoll bell pointer
+ * @param fd File descriptor
+ * @param events Epoll events
+ * @param ptr Pointer reported with the event, must not be NULL
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_epoll_watch(co_epoll_t *ep, int fd, unsigned events, void *ptr) {
+	struct epoll_event ev;
+	ev.events   = events | EPOLLONESHOT;
+	ev.data.ptr = ptr;
+	/* Usually the same fd is waited on again and again, so try modify first */
+	if (!epoll_ctl(ep->epfd, EPOLL_CTL_MOD, fd, &ev))
+		return 0;
+	if (errno == ENOENT && !epoll_ctl(ep->epfd, EPOLL_CTL_ADD, fd, &ev))
+		return 0;
+	return errno;
+}
+
+/**
+ * Watch file descriptor persistently
+ * Unlike co_epoll_watch, fd keeps being reported for as long as events are there.
+ * @param ep Epoll bell pointer
+ * @param fd File descriptor
+ * @param events Epoll events
+ * @param ptr Pointer reported with the event, must not be NULL
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_epoll_add(co_epoll_t *ep, int fd, unsigned events, void *ptr) {
+	struct epoll_event ev;
+	ev.events   = events;
+	ev.data.ptr = ptr;
+	return epoll_ctl(ep->epfd, EPOLL_CTL_ADD, fd, &ev) ? errno : 0;
+}
+
+/**
+ * Stop watching file descriptor
+ * @param ep Epoll bell pointer
+ * @param fd File descriptor
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_epoll_forget(co_epoll_t *ep, int fd) {
+	return epoll_ctl(ep->epfd, EPOLL_CTL_DEL, fd, NULL) ? errno : 0;
+}
+
+/**
+ * Wait for the bell or file descriptor events
+ * @param ep Epoll bell pointer
+ * @param until Absolute time to give up at, invalid time to wait forever, NULL not to wait at all
+ * @param events Output events of watched file descriptors, bell is not reported
+ * @param max Size of events
+ * @return: Number of events or negative error code
+ */
+static __inline__ int co_epoll_timedwait(co_epoll_t *ep, co_abstime_t *until, struct epoll_event *events, int max) {
+	int timeout = -1, n, i, j;
+	if (!until) {
+		timeout = 0;
+	} else if (!co_is_invalid_abstime(until)) {
+		co_abstime_t now;
+		unsigned long long t = co_abstime_to_ns(until), c;
+		co_get_current_time(&now);
+		c       = co_abstime_to_ns(&now);
+		timeout = t > c ? (int)((t - c + 999999) / 1000000) : 0; /* Round up, never wake up early */
+	}
+	if ((n = epoll_wait(ep->epfd, events, max, timeout)) < 0)
+		return errno == EINTR ? 0 : -errno;
+	for (i = 0, j = 0; i < n; ++i) {
+		if (events[i].data.ptr == NULL) {
+			eventfd_t v;
+			co_dbg_trace("unset epoll bell\n");
+			(void)!read(ep->evfd, &v, sizeof(v));
+			continue;
+		}
+		events[j++] = events[i];
+	}
+	return j;
+}
+
+#endif /*CO_EPOLL_H*/
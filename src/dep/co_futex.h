@@ -0,0 +1,143 @@
+#ifndef CO_FUTEX_H
+#define CO_FUTEX_H
+/**
+ * @file co_futex.h
+ *
+ * Futex based bell
+ *
+ * Same role as completion object, for a single waiter, without a mutex.
+ * Ringing a bell nobody sleeps on is a single atomic exchange, ringing a
+ * sleeping one adds a single futex wake up. Bell latches - a ring that comes
+ * before the wait is not lost, so the waiter needs no warning handshake.
+ *
+ * Before sleeping the waiter spins, then yields the CPU, for a while. The spin
+ * budget adapts: it grows when the bell rings while spinning and shrinks when
+ * the waiter ends up sleeping anyway. Linux only.
+ *
+ */
+
+#include "co_atomics.h"
+#include "co_aux.h"
+#include "co_dbg.h"
+#include "co_types.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/** Max number of polls of the bell before sleeping */
+#ifndef CO_FUTEX_SPIN_MAX
+#	define CO_FUTEX_SPIN_MAX (1024U)
+#endif
+
+/** Polls done with cpu relax, the rest of spin budget yields the CPU between polls */
+#ifndef CO_FUTEX_SPIN_RELAX
+#	define CO_FUTEX_SPIN_RELAX (128U)
+#endif
+
+/** Bell states */
+enum {
+	CO_FUTEX_IDLE     = 0,
+	CO_FUTEX_RUNG     = 1,
+	CO_FUTEX_SLEEPING = 2,
+};
+
+/**
+ * Futex bell object
+ */
+typedef struct co_futex {
+	/** Bell state, the futex word */
+	co_atom_t state;
+	/** Current spin budget, touched by the waiter only */
+	unsigned spin;
+} co_futex_t;
+
+#if defined(__x86_64__) || defined(__i386__)
+#	define __co_cpu_relax() __asm__ __volatile__("pause" ::: "memory")
+#elif defined(__aarch64__)
+#	define __co_cpu_relax() __asm__ __volatile__("yield" ::: "memory")
+#else
+#	define __co_cpu_relax() __sync_synchronize()
+#endif
+
+/**
+ * Initialize futex bell.
+ * @param fb Futex bell pointer
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_futex_init(co_futex_t *fb) {
+	fb->state = co_atom_init(CO_FUTEX_IDLE);
+	fb->spin  = CO_FUTEX_SPIN_RELAX;
+	return 0;
+}
+
+/**
+ * Destroy futex bell.
+ * @param fb Futex bell pointer
+ */
+static __inline__ void co_futex_destroy(co_futex_t *fb) { (void)fb; }
+
+/**
+ * Ring the bell.
+ * @param fb Futex bell pointer
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_futex_done(co_futex_t *fb) {
+	if (co_atom_peek(&fb->state) == CO_FUTEX_RUNG)
+		return 0; /* Already rung, keep the cache line shared */
+	if (co_atom_xchg(&fb->state, CO_FUTEX_RUNG) != CO_FUTEX_SLEEPING)
+		return 0;
+	co_dbg_trace("wake futex bell\n");
+	return syscall(SYS_futex, &fb->state.counter, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0) < 0 ? errno : 0;
+}
+
+/**
+ * Consume the ring, if any
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_futex_take(co_futex_t *fb) {
+	return co_atom_peek(&fb->state) == CO_FUTEX_RUNG && co_atom_xchg(&fb->state, CO_FUTEX_IDLE) == CO_FUTEX_RUNG;
+}
+
+/**
+ * Wait for the bell.
+ * @param fb Futex bell pointer
+ * @param until Absolute time to give up at, invalid time to wait forever
+ * @return: 0 if rung, ETIMEDOUT or error code
+ */
+static __inline__ co_errno_t co_futex_timedwait(co_futex_t *fb, co_abstime_t *until) {
+	unsigned i;
+	co_errno_t rv = 0;
+	for (i = 0; i < fb->spin; ++i) {
+		if (__co_futex_take(fb)) {
+			if ((fb->spin <<= 1) > CO_FUTEX_SPIN_MAX)
+				fb->spin = CO_FUTEX_SPIN_MAX;
+			return 0;
+		}
+		if (i < CO_FUTEX_SPIN_RELAX)
+			__co_cpu_relax();
+		else
+			sched_yield();
+	}
+	if ((fb->spin >>= 1) < CO_FUTEX_SPIN_RELAX)
+		fb->spin = CO_FUTEX_SPIN_RELAX;
+
+	if (co_atom_cmpxchg(&fb->state, CO_FUTEX_IDLE, CO_FUTEX_SLEEPING) == CO_FUTEX_RUNG) {
+		co_atom_set(&fb->state, CO_FUTEX_IDLE);
+		return 0;
+	}
+	co_dbg_trace("sleep on futex bell\n");
+	while (co_atom_peek(&fb->state) == CO_FUTEX_SLEEPING) {
+		/* Bitset flavour takes absolute time, same clock as co_abstime_t */
+		if (syscall(SYS_futex, &fb->state.counter, FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME,
+		            CO_FUTEX_SLEEPING, co_is_invalid_abstime(until) ? NULL : until, NULL, FUTEX_BITSET_MATCH_ANY) &&
+		    errno != EAGAIN && errno != EINTR) {
+			rv = errno;
+			break;
+		}
+	}
+	return co_atom_xchg(&fb->state, CO_FUTEX_IDLE) == CO_FUTEX_RUNG ? 0 : rv;
+}
+
+#endif /*CO_FUTEX_H*/
@@ -85,6 +85,8 @@ static __inline__ void co_q_cherry_pick(co_queue_t *q, co_list_e_t *elem) {
 static __inline__ co_list_e_t *co_q_peek(co_queue_t *q) { return q->head; }
 
 static __inline__ void co_q_enq_q(co_queue_t *dst, co_queue_t *src) {
+	if (!src->head)
+		return;
 	if (dst->tail)
 		dst->tail->next = src->head;
 	else
@@ -94,11 +96,50 @@ static __inline__ void co_q_enq_q(co_queue_t *dst, co_queue_t *src) {
 	*src = co_q_init();
 }
 
+struct co_hlist_e;
+/**
+ * Doubly linked list element, removable in O(1) without knowing its list
+ * Unlinked element has NULL pprev, so zero initialized one is unlinked.
+ */
+typedef struct co_hlist_e {
+	struct co_hlist_e *next, **pprev;
+} co_hlist_e_t;
+
+/**
+ * Doubly linked list head, one pointer in size
+ */
+typedef struct co_hlist {
+	struct co_hlist_e *first;
+} co_hlist_t;
+
+#define co_hlist_init()                                                                                                \
+	(co_hlist_t) { NULL }
+
+static __inline__ co_bool_t co_hlist_empty(co_hlist_t *h) { return h->first == NULL; }
+
+static __inline__ co_bool_t co_hlist_linked(co_hlist_e_t *elem) { return elem->pprev != NULL; }
+
+static __inline__ void co_hlist_add(co_hlist_t *h, co_hlist_e_t *elem) {
+	elem->next = h->first;
+	if (h->first)
+		h->first->pprev = &elem->next;
+	h->first    = elem;
+	elem->pprev = &h->first;
+}
+
+static __inline__ void co_hlist_del(co_hlist_e_t *elem) {
+	*elem->pprev = elem->next;
+	if (elem->next)
+		elem->next->pprev = elem->pprev;
+	elem->next  = NULL;
+	elem->pprev = NULL;
+}
+
 #define for_each_co_list(var, head) for ((var) = (head); (var); (var) = (var)->next)
 
 #define for_each_filter_list(var, prev, q)                                                                             \
 	for ((var) = (q)->head, (prev) = NULL; (var); (prev) = (var), (var) = (var)->next)
 
-#define for_each_drain_queue(var, q, peek, deq) for ((var) = peek(q); (var); (var) = peek(q), deq(q))
+#define for_each_drain_queue(var, q, peek, deq) for ((var) = peek(q); (var) && (deq(q), 1); (var) = peek(q))
 
 #endif /*CO_LIST_H*/
\ No newline at end of file
@@ -0,0 +1,125 @@
+#ifndef CO_PAIRING_HEAP_H
+#define CO_PAIRING_HEAP_H
+/**
+ * @file co_pairing_heap.h
+ *
+ * Pairing heap, intrusive min heap of elements ordered by key
+ *
+ * Insertion is O(1), removal of the minimum is O(log n) amortized, and it takes
+ * two pointers per element. Elements of equal keys come out in insertion order.
+ *
+ * The idea:
+ *    Heap is a tree whose every node is not greater than its children, kept as a list
+ *    of children per node. Insertion melds the new element with the root, the greater one
+ *    becoming the first child of the other. Removal of the root melds its children in pairs
+ *    left to right, then the pairs into a single tree right to left.
+ *
+ */
+
+#include "co_types.h"
+
+/**
+ * Pairing heap element, meant to be embedded in the object it orders
+ */
+typedef struct co_pheap_e {
+	/** First child */
+	struct co_pheap_e *child;
+	/** Next sibling */
+	struct co_pheap_e *next;
+	/** Ordering key, smaller first */
+	unsigned long long key;
+	/** Insertion sequence number, orders equal keys */
+	unsigned long long seq;
+} co_pheap_e_t;
+
+/**
+ * Pairing heap
+ */
+typedef struct co_pheap {
+	/** Minimum element, or NULL */
+	co_pheap_e_t *root;
+	/** Number of elements */
+	co_size_t count;
+	/** Sequence number of the next insertion */
+	unsigned long long seq;
+} co_pheap_t;
+
+#define co_pheap_init()                                                                                                \
+	(co_pheap_t) { NULL, 0, 0 }
+
+static __inline__ co_bool_t co_pheap_empty(co_pheap_t *h) { return h->root == NULL; }
+
+static __inline__ co_pheap_e_t *co_pheap_peek(co_pheap_t *h) { return h->root; }
+
+/**
+ * Test whether element goes before another one
+ * @note Internal
+ */
+static __inline__ co_bool_t __co_pheap_before(const co_pheap_e_t *a, const co_pheap_e_t *b) {
+	return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+/**
+ * Meld two trees, the root that goes after becomes the first child of the other
+ * @return Root of melded tree, its next is not touched
+ * @note Internal
+ */
+static __inline__ co_pheap_e_t *__co_pheap_meld(co_pheap_e_t *a, co_pheap_e_t *b) {
+	co_pheap_e_t *t;
+	if (__co_pheap_before(b, a)) {
+		t = a;
+		a = b;
+		b = t;
+	}
+	b->next  = a->child;
+	a->child = b;
+	return a;
+}
+
+/**
+ * Add element
+ * @param h Heap pointer
+ * @param e Element pointer, must not be in any heap
+ * @param key Ordering key
+ */
+static __inline__ void co_pheap_add(co_pheap_t *h, co_pheap_e_t *e, unsigned long long key) {
+	e->child = NULL;
+	e->next  = NULL;
+	e->key   = key;
+	e->seq   = h->seq++;
+	h->root  = h->root ? __co_pheap_meld(h->root, e) : e;
+	++h->count;
+}
+
+/**
+ * Remove the minimum element
+ * @param h Heap pointer, must not be empty
+ * @return Removed element
+ */
+static __inline__ co_pheap_e_t *co_pheap_pop(co_pheap_t *h) {
+	co_pheap_e_t *min = h->root, *pairs = NULL, *a, *b, *rest;
+	/* Meld children in pairs left to right, collecting the pairs in reverse order */
+	for (a = min->child; a; a = rest) {
+		b = a->next;
+		if (b) {
+			rest = b->next;
+			a    = __co_pheap_meld(a, b);
+		} else {
+			rest = NULL;
+		}
+		a->next = pairs;
+		pairs   = a;
+	}
+	/* Meld the pairs right to left */
+	for (a = NULL; pairs; pairs = rest) {
+		rest = pairs->next;
+		a    = a ? __co_pheap_meld(a, pairs) : pairs;
+	}
+	if (a)
+		a->next = NULL;
+	h->root = a;
+	--h->count;
+	return min;
+}
+
+#endif /*CO_PAIRING_HEAP_H*/
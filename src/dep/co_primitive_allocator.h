@@ -10,6 +10,7 @@
  */
 
 #include "co_alloc.h"
+#include "co_allocator.h"
 
 static void *co_primitive_allocator_alloc(struct co_allocator *a, co_size_t s) { return co_malloc(s); }
 static void co_primitive_allocator_free(struct co_allocator *a, void *p) { co_free(p); }
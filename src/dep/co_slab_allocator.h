@@ -0,0 +1,201 @@
+#ifndef CO_SLAB_ALLOCATOR_H
+#define CO_SLAB_ALLOCATOR_H
+/**
+ * @file co_slab_allocator.h
+ *
+ * Slab allocator, meant to be the fast allocator of a work queue.
+ *
+ * Not thread safe at all - owned by a single work queue thread, which is the only
+ * one allowed to allocate and free.
+ *
+ * The idea:
+ *    Sizes are rounded up to size classes of CO_SLAB_ALIGN bytes. Each class has
+ *    its own free list. Memory is taken from the system in pages of CO_SLAB_PAGE_SIZE,
+ *    aligned to their size, each page serving a single class. Class of a freed object
+ *    is found in the header of its page, so objects carry no header of their own.
+ *
+ *    Pages are never returned to the system until the allocator is destroyed - the
+ *    expected load is a steady stream of short lived objects of few sizes.
+ *
+ *    Objects larger than the largest class get a page of their own, freed on free.
+ *
+ */
+
+#include "co_alloc.h"
+#include "co_allocator.h"
+#include "co_list.h"
+#include "co_types.h"
+#include <stdint.h>
+
+/** Size of a page, must be a power of 2 */
+#ifndef CO_SLAB_PAGE_SIZE
+#	define CO_SLAB_PAGE_SIZE (64 * 1024)
+#endif
+
+/** Size class granularity, also alignment of objects */
+#define CO_SLAB_ALIGN (16)
+
+/** Number of size classes, objects up to CO_SLAB_CLASSES * CO_SLAB_ALIGN bytes are served from slabs */
+#define CO_SLAB_CLASSES (128)
+
+/**
+ * Page header
+ */
+typedef struct co_slab_page {
+	/** All pages of allocator, for destroy */
+	struct co_slab_page *next;
+	/** Size class, 0 for a page holding single large object */
+	co_size_t cls;
+	/** Total size of page */
+	co_size_t size;
+	/** Allocator the page belongs to */
+	struct co_slab_allocator *owner;
+} __attribute__((aligned(CO_SLAB_ALIGN))) co_slab_page_t;
+
+/**
+ * Allocator statistics
+ */
+typedef struct co_slab_stats {
+	/** Allocations served from free lists */
+	unsigned long long hits;
+	/** Allocations that had to take a new page */
+	unsigned long long misses;
+	/** Allocations too large for slabs */
+	unsigned long long large;
+	/** Objects currently allocated */
+	unsigned long long in_use;
+	/** Memory taken from the system, in bytes */
+	unsigned long long footprint;
+} co_slab_stats_t;
+
+/**
+ * Slab allocator object
+ */
+typedef struct co_slab_allocator {
+	/** Allocator interface, must be first */
+	co_allocator_t base;
+	/** Free lists per size class, index 0 unused */
+	co_list_e_t *free[CO_SLAB_CLASSES + 1];
+	/** Pages in use, slabs only */
+	co_slab_page_t *pages;
+	co_slab_stats_t stats;
+} co_slab_allocator_t;
+
+#define __co_slab_page_of(p) ((co_slab_page_t *)((uintptr_t)(p) & ~(uintptr_t)(CO_SLAB_PAGE_SIZE - 1)))
+
+/**
+ * Slab allocator an object was allocated from
+ * @param p Object pointer
+ */
+#define co_slab_owner(p) (__co_slab_page_of(p)->owner)
+
+/**
+ * Check whether an allocation of given size is served without taking a new page
+ * @param a Allocator pointer
+ * @param s Allocation size
+ * @return 1 if a free object of its class is at hand, 0 otherwise, always 0 for large sizes
+ */
+static __inline__ co_bool_t co_slab_allocator_has_free(co_slab_allocator_t *a, co_size_t s) {
+	co_size_t cls = (s + CO_SLAB_ALIGN - 1) / CO_SLAB_ALIGN;
+	return cls <= CO_SLAB_CLASSES && a->free[cls ? cls : 1] != NULL;
+}
+
+/**
+ * Take a new page and carve it into objects of class
+ * @note Internal
+ */
+static co_bool_t __co_slab_grow(co_slab_allocator_t *a, co_size_t cls) {
+	co_slab_page_t *page = co_malloc_memalign(CO_SLAB_PAGE_SIZE, CO_SLAB_PAGE_SIZE);
+	co_size_t sz         = cls * CO_SLAB_ALIGN;
+	char *first, *obj;
+	if (!page)
+		return 0;
+	page->cls   = cls;
+	page->size  = CO_SLAB_PAGE_SIZE;
+	page->owner = a;
+	page->next  = a->pages;
+	a->pages    = page;
+	a->stats.footprint += CO_SLAB_PAGE_SIZE;
+	/* Carve from the end, so that the free list goes in address order */
+	first = (char *)(page + 1);
+	for (obj = first + (CO_SLAB_PAGE_SIZE - sizeof(*page)) / sz * sz; obj > first;) {
+		obj -= sz;
+		((co_list_e_t *)obj)->next = a->free[cls];
+		a->free[cls]               = (co_list_e_t *)obj;
+	}
+	return 1;
+}
+
+static void *co_slab_allocator_alloc(struct co_allocator *base, co_size_t s) {
+	co_slab_allocator_t *a = (co_slab_allocator_t *)base;
+	co_size_t cls          = (s + CO_SLAB_ALIGN - 1) / CO_SLAB_ALIGN;
+	co_list_e_t *obj;
+	if (cls > CO_SLAB_CLASSES) {
+		co_size_t size = sizeof(co_slab_page_t) + s;
+		co_slab_page_t *page;
+		if ((page = co_malloc_memalign(CO_SLAB_PAGE_SIZE, size)) == NULL)
+			return NULL;
+		page->cls   = 0;
+		page->size  = size;
+		page->owner = a;
+		++a->stats.large;
+		++a->stats.in_use;
+		a->stats.footprint += size;
+		return page + 1;
+	}
+	if (!cls)
+		cls = 1;
+	if ((obj = a->free[cls]) != NULL) {
+		++a->stats.hits;
+	} else {
+		++a->stats.misses;
+		if (!__co_slab_grow(a, cls))
+			return NULL;
+		obj = a->free[cls];
+	}
+	a->free[cls] = obj->next;
+	++a->stats.in_use;
+	return obj;
+}
+
+static void co_slab_allocator_free(struct co_allocator *base, void *p) {
+	co_slab_allocator_t *a = (co_slab_allocator_t *)base;
+	co_slab_page_t *page   = __co_slab_page_of(p);
+	--a->stats.in_use;
+	if (!page->cls) { /* Large object, page of its own */
+		a->stats.footprint -= page->size;
+		co_free(page);
+		return;
+	}
+	((co_list_e_t *)p)->next = a->free[page->cls];
+	a->free[page->cls]       = p;
+}
+
+/**
+ * Initialize slab allocator
+ * @param a Allocator pointer
+ */
+static __inline__ void co_slab_allocator_init(co_slab_allocator_t *a) {
+	co_size_t i;
+	a->base.alloc = co_slab_allocator_alloc;
+	a->base.free  = co_slab_allocator_free;
+	for (i = 0; i <= CO_SLAB_CLASSES; ++i)
+		a->free[i] = NULL;
+	a->pages = NULL;
+	a->stats = (co_slab_stats_t){0, 0, 0, 0, 0};
+}
+
+/**
+ * Destroy slab allocator, releasing all its pages
+ * Objects still allocated become invalid. Large objects are not tracked, must be freed before.
+ * @param a Allocator pointer
+ */
+static __inline__ void co_slab_allocator_destroy(co_slab_allocator_t *a) {
+	while (a->pages) {
+		co_slab_page_t *page = a->pages;
+		a->pages             = page->next;
+		co_free(page);
+	}
+}
+
+#endif /*CO_SLAB_ALLOCATOR_H*/
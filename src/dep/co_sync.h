@@ -151,6 +151,23 @@ static __inline__ co_errno_t co_completion_done(co_completion_t *comp) {
 	return pthread_mutex_unlock(&comp->mutex);
 }
 
+/**
+ * Spin until lock is aquired.
+ * For very short critical sections only.
+ * @param lock Atom used as lock
+ */
+static __inline__ void co_spin_lock(co_atom_t *lock) {
+	while (co_atom_xchg(lock, 1))
+		while (co_atom_peek(lock))
+			;
+}
+
+/**
+ * Release spin lock.
+ * @param lock Atom used as lock
+ */
+static __inline__ void co_spin_unlock(co_atom_t *lock) { co_atom_xchg_unlock(lock); }
+
 /**
  * Get a not necesserilly unique but consistent per thread hash code
  * @return: 0 or error code
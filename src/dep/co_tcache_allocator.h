@@ -0,0 +1,211 @@
+#ifndef CO_TCACHE_ALLOCATOR_H
+#define CO_TCACHE_ALLOCATOR_H
+/**
+ * @file co_tcache_allocator.h
+ *
+ * Thread caching allocator, meant to be the slow allocator, shared by all work
+ * queues and by the threads that create root coroutines.
+ *
+ * Thread safe. Any thread may allocate and free.
+ *
+ * The idea:
+ *    Each thread that allocates gets a cache of its own - a slab allocator, see
+ *    co_slab_allocator.h - so allocations never contend. Pages of a slab know
+ *    their cache, so a free from the owner thread goes straight to the slab.
+ *
+ *    A free from any other thread, typically a work queue thread freeing a finished
+ *    coroutine, is pushed to the remote free list of the owner cache, a lock free
+ *    stack. The owner takes the whole stack with a single exchange, when the class it
+ *    allocates has nothing left, so remote frees are paid for in batches.
+ *
+ *    A cache outlives its thread: objects allocated by a thread may be freed long
+ *    after it exits. Cache of exited thread is adopted by the next new thread.
+ *
+ */
+
+#include "co_alloc.h"
+#include "co_allocator.h"
+#include "co_list.h"
+#include "co_slab_allocator.h"
+#include "co_types.h"
+#include <pthread.h>
+
+/**
+ * Cache of a thread
+ */
+typedef struct co_tcache {
+	/** Slab allocator of the thread, must be first */
+	co_slab_allocator_t slab;
+	/** All caches of allocator */
+	struct co_tcache *next;
+	/** Objects taken back from remote free list */
+	unsigned long long remote_frees;
+	/** Times remote free list was taken */
+	unsigned long long drains;
+	/** Owner thread exited, cache can be adopted */
+	co_bool_t orphan;
+	/** Objects freed by other threads, pushed by them, on a cache line of its own */
+	co_list_e_t *remote __attribute__((aligned(64)));
+} co_tcache_t;
+
+/**
+ * Allocator statistics, summed over all caches
+ */
+typedef struct co_tcache_stats {
+	/** Slab statistics */
+	co_slab_stats_t slab;
+	/** Number of caches */
+	co_size_t caches;
+	/** Objects freed by non owner threads, returned to their caches */
+	unsigned long long remote_frees;
+	/** Batches they were returned in */
+	unsigned long long drains;
+} co_tcache_stats_t;
+
+/**
+ * Thread caching allocator object
+ */
+typedef struct co_tcache_allocator {
+	/** Allocator interface, must be first */
+	co_allocator_t base;
+	/** Cache of current thread */
+	pthread_key_t key;
+	/** Protects the list of caches */
+	pthread_mutex_t lock;
+	/** All caches */
+	co_tcache_t *caches;
+} co_tcache_allocator_t;
+
+/**
+ * Take back objects freed by other threads
+ * @note Internal
+ */
+static void __co_tcache_drain(co_tcache_t *c) {
+	co_list_e_t *e = __atomic_exchange_n(&c->remote, NULL, __ATOMIC_ACQUIRE), *next;
+	if (!e)
+		return;
+	++c->drains;
+	for (; e; e = next) {
+		next = e->next;
+		co_slab_allocator_free(&c->slab.base, e);
+		++c->remote_frees;
+	}
+}
+
+/**
+ * Thread specific data destructor, owner thread exits
+ * @note Internal
+ */
+static void __co_tcache_orphan(void *c) { __atomic_store_n(&((co_tcache_t *)c)->orphan, 1, __ATOMIC_RELEASE); }
+
+/**
+ * Attach a cache to current thread, first allocation of the thread
+ * @note Internal
+ */
+static co_tcache_t *__co_tcache_attach(co_tcache_allocator_t *a) {
+	co_tcache_t *c;
+	pthread_mutex_lock(&a->lock);
+	for (c = a->caches; c; c = c->next)
+		if (__atomic_load_n(&c->orphan, __ATOMIC_ACQUIRE))
+			break;
+	if (c) {
+		c->orphan = 0;
+	} else if ((c = co_malloc_memalign(64, sizeof(*c))) != NULL) {
+		co_slab_allocator_init(&c->slab);
+		c->remote_frees = 0;
+		c->drains       = 0;
+		c->orphan       = 0;
+		c->remote       = NULL;
+		c->next         = a->caches;
+		a->caches       = c;
+	}
+	pthread_mutex_unlock(&a->lock);
+	if (c && pthread_setspecific(a->key, c)) {
+		__co_tcache_orphan(c);
+		return NULL;
+	}
+	return c;
+}
+
+static void *co_tcache_allocator_alloc(struct co_allocator *base, co_size_t s) {
+	co_tcache_allocator_t *a = (co_tcache_allocator_t *)base;
+	co_tcache_t *c           = pthread_getspecific(a->key);
+	if (!c && (c = __co_tcache_attach(a)) == NULL)
+		return NULL;
+	if (__atomic_load_n(&c->remote, __ATOMIC_RELAXED) && !co_slab_allocator_has_free(&c->slab, s))
+		__co_tcache_drain(c);
+	return co_slab_allocator_alloc(&c->slab.base, s);
+}
+
+static void co_tcache_allocator_free(struct co_allocator *base, void *p) {
+	co_tcache_allocator_t *a = (co_tcache_allocator_t *)base;
+	co_tcache_t *c           = (co_tcache_t *)co_slab_owner(p);
+	co_list_e_t *e           = p;
+	if (c == pthread_getspecific(a->key)) {
+		co_slab_allocator_free(&c->slab.base, p);
+		return;
+	}
+	e->next = __atomic_load_n(&c->remote, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&c->remote, &e->next, e, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * Initialize thread caching allocator
+ * @param a Allocator pointer
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_tcache_allocator_init(co_tcache_allocator_t *a) {
+	co_errno_t rv;
+	a->base.alloc = co_tcache_allocator_alloc;
+	a->base.free  = co_tcache_allocator_free;
+	a->caches     = NULL;
+	if ((rv = pthread_key_create(&a->key, __co_tcache_orphan)) != 0)
+		return rv;
+	if ((rv = pthread_mutex_init(&a->lock, NULL)) != 0)
+		pthread_key_delete(a->key);
+	return rv;
+}
+
+/**
+ * Destroy thread caching allocator, releasing all caches
+ * No thread may use the allocator any more. Objects still allocated become invalid.
+ * @param a Allocator pointer
+ */
+static __inline__ void co_tcache_allocator_destroy(co_tcache_allocator_t *a) {
+	while (a->caches) {
+		co_tcache_t *c = a->caches;
+		a->caches      = c->next;
+		__co_tcache_drain(c);
+		co_slab_allocator_destroy(&c->slab);
+		co_free(c);
+	}
+	pthread_key_delete(a->key);
+	pthread_mutex_destroy(&a->lock);
+}
+
+/**
+ * Get allocator statistics
+ * Counters of other threads are read on the fly, so the sum is approximate while they run.
+ * Objects waiting on remote free lists are still counted in use.
+ * @param a Allocator pointer
+ * @param stats Output
+ */
+static __inline__ void co_tcache_allocator_stats(co_tcache_allocator_t *a, co_tcache_stats_t *stats) {
+	co_tcache_t *c;
+	*stats = (co_tcache_stats_t){{0, 0, 0, 0, 0}, 0, 0, 0};
+	pthread_mutex_lock(&a->lock);
+	for (c = a->caches; c; c = c->next) {
+		stats->slab.hits += c->slab.stats.hits;
+		stats->slab.misses += c->slab.stats.misses;
+		stats->slab.large += c->slab.stats.large;
+		stats->slab.in_use += c->slab.stats.in_use;
+		stats->slab.footprint += c->slab.stats.footprint;
+		stats->remote_frees += c->remote_frees;
+		stats->drains += c->drains;
+		++stats->caches;
+	}
+	pthread_mutex_unlock(&a->lock);
+}
+
+#endif /*CO_TCACHE_ALLOCATOR_H*/
@@ -0,0 +1,116 @@
+#ifndef CO_THREAD_POOL_H
+#define CO_THREAD_POOL_H
+/**
+ * @file co_thread_pool.h
+ *
+ * Minimal helper thread pool
+ *
+ * Runs jobs that must block, such as system calls, away from work queue threads.
+ * Jobs are queue elements, all handled by the same work function. Meant for
+ * slow paths, so simple mutex and condition variable are good enough.
+ *
+ */
+
+#include "co_alloc.h"
+#include "co_list.h"
+#include "co_types.h"
+#include <pthread.h>
+
+/**
+ * Thread pool object
+ */
+typedef struct co_thread_pool {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/** Pending jobs */
+	co_queue_t q;
+	/** Indicator to terminate threads */
+	co_bool_t stop;
+	/** Job handler */
+	void (*work)(co_list_e_t *);
+	pthread_t *threads;
+	co_size_t n;
+} co_thread_pool_t;
+
+static void *__co_thread_pool_main(void *param) {
+	co_thread_pool_t *pool = (co_thread_pool_t *)param;
+	pthread_mutex_lock(&pool->mutex);
+	while (1) {
+		co_list_e_t *job;
+		while (co_q_empty(&pool->q) && !pool->stop)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+		if ((job = co_q_peek(&pool->q)) == NULL)
+			break; /* Stopped, and nothing left */
+		co_q_deq(&pool->q);
+		pthread_mutex_unlock(&pool->mutex);
+		pool->work(job);
+		pthread_mutex_lock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+/**
+ * Stop thread pool and wait for all the threads
+ * Jobs pushed before are handled before threads exit.
+ * @param pool Thread pool pointer
+ */
+static __inline__ void co_thread_pool_destroy(co_thread_pool_t *pool) {
+	co_size_t i;
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i = 0; i < pool->n; ++i)
+		pthread_join(pool->threads[i], NULL);
+	co_free(pool->threads);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+}
+
+/**
+ * Initialize thread pool and start its threads
+ * @param pool Thread pool pointer
+ * @param n Number of threads
+ * @param work Job handler
+ * @return 0 or error code
+ */
+static __inline__ co_errno_t co_thread_pool_init(co_thread_pool_t *pool, co_size_t n, void (*work)(co_list_e_t *)) {
+	co_errno_t rv;
+	pool->q    = co_q_init();
+	pool->stop = 0;
+	pool->work = work;
+	pool->n    = 0;
+	if ((pool->threads = co_malloc(n * sizeof(pthread_t))) == NULL)
+		return -ENOMEM;
+	if ((rv = pthread_mutex_init(&pool->mutex, NULL)) != 0) {
+		co_free(pool->threads);
+		return rv;
+	}
+	if ((rv = pthread_cond_init(&pool->cond, NULL)) != 0) {
+		pthread_mutex_destroy(&pool->mutex);
+		co_free(pool->threads);
+		return rv;
+	}
+	for (; pool->n < n; ++pool->n) {
+		if ((rv = pthread_create(&pool->threads[pool->n], NULL, __co_thread_pool_main, pool)) != 0) {
+			co_thread_pool_destroy(pool);
+			return rv;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Push a job to be handled by one of the threads
+ * @param pool Thread pool pointer
+ * @param job Job queue element
+ */
+static __inline__ void co_thread_pool_push(co_thread_pool_t *pool, co_list_e_t *job) {
+	pthread_mutex_lock(&pool->mutex);
+	co_q_enq(&pool->q, job);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+#endif /*CO_THREAD_POOL_H*/
@@ -3,34 +3,49 @@
 /**
  * @file co_timeout.h
  *
- * Contains definition of special coroutine used to handle timeouts
+ * Contains definition of timeout related yielding macros
  *
  */
 
 #include "../co_coroutines.h"
 #include "co_aux.h"
 
-co_routine_decl(/*void*/, __co_internal_timeout, co_abstime_t, until);
-
-co_yield_rv_t __co_internal_timeout(struct __co_internal_timeout_co_obj *self) {
-	co_routine_begin(self, __co_internal_timeout);
-
-	while (!co_time_passed(&self->args.until)) {
-		__co_adjust_wake_up(self->obj.wq, &self->args.until);
-		co_yield_wait(self);
-	}
-
-	co_yield_break();
-}
-
+/**
+ * Yield coroutine and send it to sleep for given time
+ * Coroutine is parked in the timer wheel of its work queue, off execq, until the deadline.
+ * @param self Calling coroutine
+ * @param timeout Time to sleep in nanoseconds
+ */
 #define co_yield_wait_timeout(self, timeout)                                                                           \
 	{                                                                                                                  \
-		co_abstime_t __co_until;                                                                                       \
-		struct __co_internal_timeout_co_obj *__co_timeout;                                                             \
-		co_get_time_in_future(timeout, &__co_until);                                                                   \
-		__co_timeout = co_fork_run(self, __co_internal_timeout, __co_until);                                           \
-		if (__co_timeout)                                                                                              \
-			co_yield_await(self, __co_timeout);                                                                        \
+		co_multi_co_wq_sleep((self)->obj.wq, &(self)->obj, timeout);                                                   \
+		co_yield_park(self);                                                                                           \
 	}
 
-#endif /*CO_TIMEOUT_H*/
\ No newline at end of file
+#ifdef CO_MULTI_CO_WQ_AWAIT_TIMEOUT
+/**
+ * Await other coroutine, giving up once timeout passes
+ * Coroutine resumes on next yield of target or on deadline, whichever comes first, the latter
+ * taking it off the await list of target, which goes on running. Target must not be force
+ * terminated meanwhile, cancel it instead. Needs CO_MULTI_CO_WQ_AWAIT_TIMEOUT.
+ * @param self Coroutine self pointer
+ * @param target Coroutine object pointer to await
+ * @param timeout Time to await in nanoseconds
+ */
+#	define co_yield_await_timeout(self, target, timeout)                                                               \
+		(self)->obj.ip      = &&co_label_checkpoint_await - &&__co_label_start;                                        \
+		(self)->obj.qe.next = (target)->obj.await;                                                                     \
+		(target)->obj.await = &(self)->obj.qe;                                                                         \
+		co_multi_co_wq_await_deadline((self)->obj.wq, &(self)->obj, &(target)->obj, timeout);                          \
+		return CO_RV_YIELD_AWAIT;                                                                                      \
+	co_label_checkpoint_await:                                                                                         \
+		__co_nop();
+
+/**
+ * Test whether the last co_yield_await_timeout of coroutine gave up on its deadline
+ * @param self Coroutine self pointer
+ */
+#	define co_await_timed_out(self) co_routine_flag_test((self)->obj.flags, CO_FLAG_TIMEDOUT)
+#endif
+
+#endif /*CO_TIMEOUT_H*/
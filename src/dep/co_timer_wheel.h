@@ -0,0 +1,230 @@
+#ifndef CO_TIMER_WHEEL_H
+#define CO_TIMER_WHEEL_H
+/**
+ * @file co_timer_wheel.h
+ *
+ * Hierarchical timer wheel
+ *
+ * Keeps timers ordered by expiration tick with O(1) insertion and removal,
+ * and O(1) amortized expiration.
+ *
+ * The idea:
+ *    Maintain CO_TIMER_WHEEL_LEVELS wheels of CO_TIMER_WHEEL_SLOTS slots each.
+ *    A slot of level 0 holds timers expiring at exactly one tick, a slot of level 1
+ *    timers expiring within a range of CO_TIMER_WHEEL_SLOTS ticks, and so on.
+ *    Timer goes to the lowest level whose range covers its distance from now.
+ *
+ *    When time reaches the beginning of a higher level slot range, the slot is
+ *    cascaded - its timers are added again, landing on lower levels. Each timer is
+ *    cascaded at most once per level, unless it is beyond the top level range.
+ *
+ *    Occupied slots of each level are tracked in a bitmap, so empty stretches of time
+ *    are skipped at once, and the next event is known without scanning the slots.
+ *    Bits are cleared lazily, when the slot is processed, so removal is O(1).
+ *
+ */
+
+#include "co_list.h"
+#include "co_types.h"
+#include "../utils/co_macro.h"
+
+/**
+ * Timer wheel time unit
+ */
+typedef unsigned long long co_tick_t;
+
+#define CO_TIMER_WHEEL_BITS (6)
+#define CO_TIMER_WHEEL_SLOTS (1 << CO_TIMER_WHEEL_BITS)
+#define CO_TIMER_WHEEL_MASK (CO_TIMER_WHEEL_SLOTS - 1)
+#define CO_TIMER_WHEEL_LEVELS (4)
+
+#define co_timer_wheel_shift(lvl) (CO_TIMER_WHEEL_BITS * (lvl))
+
+/**
+ * Timer, meant to be embedded in the object it times
+ */
+typedef struct co_timer {
+	/** Slot list element */
+	co_hlist_e_t e;
+	/** Expiration tick */
+	co_tick_t expires;
+} co_timer_t;
+
+/**
+ * Timer wheel
+ */
+typedef struct co_timer_wheel {
+	/** Slots of all levels */
+	co_hlist_t slots[CO_TIMER_WHEEL_LEVELS][CO_TIMER_WHEEL_SLOTS];
+	/** Bitmap of possibly non empty slots, per level */
+	unsigned long long occupied[CO_TIMER_WHEEL_LEVELS];
+	/** Current tick, all timers up to it have expired */
+	co_tick_t now;
+	/** Deadlines are rounded up to multiple of slack ticks, to coalesce nearby ones */
+	co_tick_t slack;
+	/** Number of pending timers */
+	co_size_t count;
+} co_timer_wheel_t;
+
+/**
+ * Initialize timer wheel
+ * @param w Timer wheel pointer
+ * @param now Current tick
+ * @param slack Deadline granularity in ticks, 0 or 1 for exact deadlines
+ */
+static __inline__ void co_timer_wheel_init(co_timer_wheel_t *w, co_tick_t now, co_tick_t slack) {
+	int lvl, slot;
+	for (lvl = 0; lvl < CO_TIMER_WHEEL_LEVELS; ++lvl) {
+		for (slot = 0; slot < CO_TIMER_WHEEL_SLOTS; ++slot)
+			w->slots[lvl][slot] = co_hlist_init();
+		w->occupied[lvl] = 0;
+	}
+	w->now   = now;
+	w->slack = slack;
+	w->count = 0;
+}
+
+/**
+ * Test whether timer is pending
+ * @param t Timer pointer
+ * @return 1 if pending else 0
+ */
+static __inline__ co_bool_t co_timer_pending(co_timer_t *t) { return co_hlist_linked(&t->e); }
+
+/**
+ * Put timer in its slot
+ * @note Internal. Assumes expires >= now.
+ */
+static __inline__ void __co_timer_wheel_place(co_timer_wheel_t *w, co_timer_t *t) {
+	co_tick_t delta = t->expires - w->now;
+	int lvl, slot;
+	for (lvl = 0; lvl < CO_TIMER_WHEEL_LEVELS - 1 && (delta >> co_timer_wheel_shift(lvl + 1)); ++lvl)
+		;
+	/* Beyond the top level range the slot aliases, it will just be cascaded again */
+	slot = (t->expires >> co_timer_wheel_shift(lvl)) & CO_TIMER_WHEEL_MASK;
+	co_hlist_add(&w->slots[lvl][slot], &t->e);
+	w->occupied[lvl] |= 1ULL << slot;
+	++w->count;
+}
+
+/**
+ * Add timer
+ * Deadline that already passed expires on the next tick.
+ * @param w Timer wheel pointer
+ * @param t Timer pointer, must not be pending
+ * @param expires Expiration tick
+ */
+static __inline__ void co_timer_wheel_add(co_timer_wheel_t *w, co_timer_t *t, co_tick_t expires) {
+	if (w->slack > 1)
+		expires += (w->slack - expires % w->slack) % w->slack;
+	t->expires = expires > w->now ? expires : w->now + 1;
+	__co_timer_wheel_place(w, t);
+}
+
+/**
+ * Remove pending timer
+ * @param w Timer wheel pointer
+ * @param t Timer pointer
+ */
+static __inline__ void co_timer_wheel_del(co_timer_wheel_t *w, co_timer_t *t) {
+	co_hlist_del(&t->e);
+	--w->count;
+}
+
+/**
+ * Find the next tick the wheel has something to do at
+ * It is either expiration or cascade, which is never later than expiration of cascaded timers.
+ * @param w Timer wheel pointer
+ * @param next Output tick
+ * @return 1 if found else 0
+ */
+static __inline__ co_bool_t co_timer_wheel_next(co_timer_wheel_t *w, co_tick_t *next) {
+	co_bool_t found = 0;
+	co_tick_t best  = 0;
+	int lvl;
+	for (lvl = 0; lvl < CO_TIMER_WHEEL_LEVELS; ++lvl) {
+		unsigned long long bits = w->occupied[lvl];
+		co_tick_t base          = w->now >> co_timer_wheel_shift(lvl), tick;
+		int rot                 = (base + 1) & CO_TIMER_WHEEL_MASK;
+		if (!bits)
+			continue;
+		/* Rotate, so bit 0 is the slot right after the current */
+		bits = (bits >> rot) | (bits << ((CO_TIMER_WHEEL_SLOTS - rot) & CO_TIMER_WHEEL_MASK));
+		tick = (base + 1 + __builtin_ctzll(bits)) << co_timer_wheel_shift(lvl);
+		if (!found || tick < best)
+			best = tick;
+		found = 1;
+	}
+	if (found)
+		*next = best;
+	return found;
+}
+
+/**
+ * Advance the wheel time, collecting expired timers
+ * @param w Timer wheel pointer
+ * @param now Current tick
+ * @param expired Expired timers are moved here
+ */
+static __inline__ void co_timer_wheel_advance(co_timer_wheel_t *w, co_tick_t now, co_hlist_t *expired) {
+	co_tick_t tick;
+	int lvl;
+	while (w->count && co_timer_wheel_next(w, &tick) && tick <= now) {
+		co_hlist_t *slot;
+		w->now = tick;
+		/* Cascade higher levels first, they may refill lower levels at this very tick */
+		for (lvl = CO_TIMER_WHEEL_LEVELS - 1; lvl > 0; --lvl) {
+			int idx = (tick >> co_timer_wheel_shift(lvl)) & CO_TIMER_WHEEL_MASK;
+			co_hlist_t cascade = co_hlist_init();
+			if (tick & ((1ULL << co_timer_wheel_shift(lvl)) - 1))
+				continue; /* Not at the beginning of slot range */
+			slot = &w->slots[lvl][idx];
+			w->occupied[lvl] &= ~(1ULL << idx);
+			/* Detach first, far timers may land in this very slot again */
+			while (!co_hlist_empty(slot)) {
+				co_hlist_e_t *e = slot->first;
+				co_timer_wheel_del(w, __co_container_of(e, co_timer_t, e));
+				co_hlist_add(&cascade, e);
+			}
+			while (!co_hlist_empty(&cascade)) {
+				co_timer_t *t = __co_container_of(cascade.first, co_timer_t, e);
+				co_hlist_del(&t->e);
+				__co_timer_wheel_place(w, t);
+			}
+		}
+		/* Now expire */
+		slot = &w->slots[0][tick & CO_TIMER_WHEEL_MASK];
+		w->occupied[0] &= ~(1ULL << (tick & CO_TIMER_WHEEL_MASK));
+		while (!co_hlist_empty(slot)) {
+			co_hlist_e_t *e = slot->first;
+			co_timer_wheel_del(w, __co_container_of(e, co_timer_t, e));
+			co_hlist_add(expired, e);
+		}
+	}
+	if (!w->count) /* Forget stale bits */
+		for (lvl = 0; lvl < CO_TIMER_WHEEL_LEVELS; ++lvl)
+			w->occupied[lvl] = 0;
+	if (now > w->now)
+		w->now = now;
+}
+
+/**
+ * Remove all pending timers, regardless of expiration
+ * @param w Timer wheel pointer
+ * @param out Removed timers are moved here
+ */
+static __inline__ void co_timer_wheel_drain(co_timer_wheel_t *w, co_hlist_t *out) {
+	int lvl, slot;
+	for (lvl = 0; lvl < CO_TIMER_WHEEL_LEVELS; ++lvl) {
+		for (slot = 0; slot < CO_TIMER_WHEEL_SLOTS; ++slot) {
+			while (!co_hlist_empty(&w->slots[lvl][slot])) {
+				co_hlist_e_t *e = w->slots[lvl][slot].first;
+				co_timer_wheel_del(w, __co_container_of(e, co_timer_t, e));
+				co_hlist_add(out, e);
+			}
+		}
+		w->occupied[lvl] = 0;
+	}
+}
+
+#endif /*CO_TIMER_WHEEL_H*/
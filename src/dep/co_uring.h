@@ -0,0 +1,201 @@
+#ifndef CO_URING_H
+#define CO_URING_H
+/**
+ * @file co_uring.h
+ *
+ * Minimal io_uring wrapper
+ *
+ * Just enough to set up a ring, fill submission entries, submit them in a batch
+ * and reap completions, without depending on liburing. Single threaded - ring
+ * must be used by one thread only. Linux only.
+ *
+ */
+
+#include "co_types.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Ring object
+ */
+typedef struct co_uring {
+	/** Ring file descriptor */
+	int fd;
+	/** Submission queue */
+	struct {
+		unsigned *head, *tail, *array;
+		unsigned mask, entries;
+		struct io_uring_sqe *sqes;
+		/** Entries filled but not submitted yet */
+		unsigned pending;
+	} sq;
+	/** Completion queue */
+	struct {
+		unsigned *head, *tail;
+		unsigned mask;
+		struct io_uring_cqe *cqes;
+	} cq;
+	/** Mappings, for cleanup */
+	void *sq_ptr, *cq_ptr;
+	co_size_t sq_sz, cq_sz;
+} co_uring_t;
+
+#define __co_uring_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define __co_uring_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * Initialize ring.
+ * @param r Ring pointer
+ * @param entries Submission queue size
+ * @return: 0 or error code
+ */
+static __inline__ co_errno_t co_uring_init(co_uring_t *r, unsigned entries) {
+	struct io_uring_params p;
+	co_errno_t rv;
+
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return errno;
+	if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close(r->fd);
+		return ENOTSUP; /* Too old, not worth the trouble */
+	}
+
+	r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_sz = r->cq_sz = r->sq_sz > r->cq_sz ? r->sq_sz : r->cq_sz;
+
+	r->sq_ptr = mmap(0, r->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto err_fd;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(0, r->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+			goto err_sq;
+	}
+	r->sq.sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+	                  MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sq.sqes == MAP_FAILED)
+		goto err_cq;
+
+	r->sq.head    = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq.tail    = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq.array   = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->sq.mask    = *(unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq.entries = p.sq_entries;
+	r->cq.head    = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq.tail    = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq.mask    = *(unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cq.cqes    = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+	return 0;
+
+err_cq:
+	rv = errno;
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_sz);
+	errno = rv;
+err_sq:
+	rv = errno;
+	munmap(r->sq_ptr, r->sq_sz);
+	errno = rv;
+err_fd:
+	rv = errno;
+	close(r->fd);
+	return rv;
+}
+
+/**
+ * Destroy ring.
+ * @param r Ring pointer
+ */
+static __inline__ void co_uring_destroy(co_uring_t *r) {
+	munmap(r->sq.sqes, r->sq.entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_sz);
+	munmap(r->sq_ptr, r->sq_sz);
+	close(r->fd);
+}
+
+/**
+ * Get next free submission entry, zeroed
+ * Entry is published right away, but kernel sees it only after co_uring_submit.
+ * @param r Ring pointer
+ * @return Entry pointer or NULL if submission queue is full
+ */
+static __inline__ struct io_uring_sqe *co_uring_get_sqe(co_uring_t *r) {
+	unsigned tail = *r->sq.tail, idx;
+	struct io_uring_sqe *sqe;
+	if (tail - __co_uring_load_acquire(r->sq.head) >= r->sq.entries)
+		return NULL;
+	idx = tail & r->sq.mask;
+	sqe = &r->sq.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq.array[idx] = idx;
+	__co_uring_store_release(r->sq.tail, tail + 1);
+	++r->sq.pending;
+	return sqe;
+}
+
+/**
+ * Take back the newest entry filled but not submitted yet
+ * @param r Ring pointer
+ * @return Entry pointer, valid until the next co_uring_get_sqe, or NULL if none is pending
+ */
+static __inline__ struct io_uring_sqe *co_uring_unget_sqe(co_uring_t *r) {
+	unsigned tail;
+	if (!r->sq.pending)
+		return NULL;
+	tail = *r->sq.tail - 1;
+	__co_uring_store_release(r->sq.tail, tail);
+	--r->sq.pending;
+	return &r->sq.sqes[r->sq.array[tail & r->sq.mask]];
+}
+
+/**
+ * Submit all pending entries in one system call
+ * Entries not taken by the kernel stay pending.
+ * @param r Ring pointer
+ * @return: 0 or error code, EAGAIN if kernel took none
+ */
+static __inline__ co_errno_t co_uring_submit(co_uring_t *r) {
+	while (r->sq.pending) {
+		int n = syscall(__NR_io_uring_enter, r->fd, r->sq.pending, 0, 0, NULL, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0)
+			return EAGAIN; /* No progress, do not spin on it */
+		r->sq.pending -= n;
+	}
+	return 0;
+}
+
+/**
+ * Get oldest available completion entry, without consuming it
+ * @param r Ring pointer
+ * @return Entry pointer or NULL if none
+ */
+static __inline__ struct io_uring_cqe *co_uring_peek_cqe(co_uring_t *r) {
+	unsigned head = *r->cq.head;
+	if (head == __co_uring_load_acquire(r->cq.tail))
+		return NULL;
+	return &r->cq.cqes[head & r->cq.mask];
+}
+
+/**
+ * Consume oldest completion entry, after which it must not be accessed
+ * @param r Ring pointer
+ */
+static __inline__ void co_uring_cqe_seen(co_uring_t *r) { __co_uring_store_release(r->cq.head, *r->cq.head + 1); }
+
+#endif /*CO_URING_H*/
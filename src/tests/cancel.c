@@ -0,0 +1,161 @@
+/**
+ * @file cancel.c
+ *
+ * Cancellation: co_cancel and co_on_cancel
+ *
+ * Victims run in place, spinning or sleeping, with or without a cancellation handler.
+ * Checks a cancelled coroutine stops where it yielded and runs its handler once, or
+ * terminates right away without one, that sleepers are woken up for it, that it goes down
+ * to descendants, whose parent handler may await them, and that those awaiting a cancelled
+ * coroutine are woken up once it terminates.
+ *
+ */
+
+#include "test.h"
+#include "co_coroutines.h"
+#include "co_shortcuts.h"
+#include "dep/co_primitive_allocator.h"
+#include "dep/co_timeout.h"
+
+/** What a victim does until cancelled */
+enum { VICTIM_SPIN, VICTIM_SLEEP };
+
+/** Long enough to never pass while the test runs, in nanoseconds */
+#define CANCEL_FOREVER (100000000000UL)
+
+static co_multi_co_wq_t wq;
+
+co_routine_decl(int, victim, int, mode, int, handler, int, steps, int, handled);
+co_routine_decl(int, twice, int, handled);
+co_routine_decl(int, mid, int, saw);
+co_routine_decl(int, cancel_main, int, unused);
+
+/* Spins or sleeps forever, counting handler runs if it has one */
+co_yield_rv_t victim(struct victim_co_obj *self) {
+	co_routine_begin(self, victim);
+	if (_(handler)) {
+		co_on_cancel(self) {
+			++_(handled);
+		}
+	}
+	for (;;) {
+		++_(steps);
+		if (_(mode) == VICTIM_SLEEP) {
+			co_yield_wait_timeout(self, CANCEL_FOREVER);
+		} else {
+			co_yield_return(self, 0);
+		}
+	}
+	co_yield_break();
+}
+
+/* Later handler replaces the earlier one, then cancels itself */
+co_yield_rv_t twice(struct twice_co_obj *self) {
+	co_routine_begin(self, twice);
+	co_on_cancel(self) {
+		_(handled) = 1;
+	}
+	co_on_cancel(self) {
+		_(handled) = 2;
+	}
+	co_cancel(self, self);
+	co_yield_return(self, 0);
+	_(handled) = -1;
+	co_yield_break();
+}
+
+/* State of mid and cancel_main, kept across yields */
+static struct victim_co_obj vs[2], gc[2];
+static struct twice_co_obj tw;
+static struct mid_co_obj md;
+
+/**
+ * Await child in place until it terminates, if it did not yet
+ * @param self Calling coroutine
+ * @param child Child in place
+ */
+#define await_child(self, child)                                                                                       \
+	while (!co_is_terminated(&(child)->obj)) {                                                                         \
+		co_yield_await(self, child);                                                                                   \
+	}
+
+/* Forks grandchildren, its handler awaits them and tells whether they were cancelled too */
+co_yield_rv_t mid(struct mid_co_obj *self) {
+	co_routine_begin(self, mid);
+	co_fork_run_inplace(self, &gc[0], victim, VICTIM_SPIN, 0, 0, 0);
+	co_fork_run_inplace(self, &gc[1], victim, VICTIM_SLEEP, 1, 0, 0);
+	co_on_cancel(self) {
+		await_child(self, &gc[0]);
+		await_child(self, &gc[1]);
+		_(saw) = co_is_cancelled(&gc[0].obj) && co_is_cancelled(&gc[1].obj) && gc[1].args.handled == 1;
+	}
+	await_child(self, &gc[1]);
+	co_yield_break();
+}
+
+co_yield_rv_t cancel_main(struct cancel_main_co_obj *self) {
+	co_routine_begin(self, cancel_main);
+
+	/* Spinning, without and with handler: stop where they yielded */
+	co_fork_run_inplace(self, &vs[0], victim, VICTIM_SPIN, 0, 0, 0);
+	co_fork_run_inplace(self, &vs[1], victim, VICTIM_SPIN, 1, 0, 0);
+	co_yield_return(self, 0);
+	co_yield_return(self, 0);
+	test_check(vs[0].args.steps == 2 && vs[1].args.steps == 2);
+	co_cancel(self, &vs[0]);
+	co_cancel(self, &vs[1]);
+	test_check(co_is_cancelled(&vs[0].obj) && !co_is_terminated(&vs[0].obj));
+	await_child(self, &vs[0]);
+	await_child(self, &vs[1]);
+	test_check(co_is_cancelled(&vs[0].obj) && vs[0].args.steps == 2 && vs[0].args.handled == 0);
+	test_check(co_is_cancelled(&vs[1].obj) && vs[1].args.steps == 2 && vs[1].args.handled == 1);
+
+	/* Cancelled again: nothing happens */
+	co_cancel(self, &vs[1]);
+	test_check(vs[1].args.handled == 1);
+
+	/* Cancelled itself, the later handler runs instead of going on */
+	co_fork_run_inplace(self, &tw, twice, 0);
+	await_child(self, &tw);
+	test_check(co_is_cancelled(&tw.obj) && tw.args.handled == 2);
+
+	/* Cancelled before it ran: never runs at all */
+	co_fork_run_inplace(self, &vs[0], victim, VICTIM_SPIN, 1, 0, 0);
+	co_cancel(self, &vs[0]);
+	await_child(self, &vs[0]);
+	test_check(vs[0].args.steps == 0 && vs[0].args.handled == 0);
+
+	/* Sleeper is woken up for it, right away */
+	co_fork_run_inplace(self, &vs[1], victim, VICTIM_SLEEP, 1, 0, 0);
+	co_yield_return(self, 0);
+	test_check(vs[1].args.steps == 1 && !co_is_terminated(&vs[1].obj));
+	co_cancel(self, &vs[1]);
+	await_child(self, &vs[1]);
+	test_check(vs[1].args.steps == 1 && vs[1].args.handled == 1);
+
+	/* Descendants are cancelled too, parent handler awaits them */
+	co_fork_run_inplace(self, &md, mid, 0);
+	co_yield_return(self, 0);
+	co_yield_return(self, 0);
+	test_check(gc[0].args.steps > 0 && gc[1].args.steps == 1);
+	co_cancel(self, &md);
+	test_check(co_is_cancelled(&gc[0].obj) && co_is_cancelled(&gc[1].obj));
+	await_child(self, &md);
+	test_check(co_is_cancelled(&md.obj) && md.args.saw == 1);
+	test_check(co_is_terminated(&gc[0].obj) && co_is_terminated(&gc[1].obj));
+
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	struct cancel_main_co_obj *m;
+
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	m = co_new(&wq, cancel_main, 0);
+	co_schedule(&wq, m);
+	co_multi_co_wq_loop(&wq);
+	co_multi_co_wq_destroy(&wq);
+	return test_report("cancel");
+}
@@ -0,0 +1,203 @@
+/**
+ * @file chan.c
+ *
+ * Channels, co_chan_t on a single work queue and co_chan_mt_t across work queues
+ *
+ * Checks order, capacity and parking of either side on co_chan_t, then moves elements
+ * through co_chan_mt_t from coroutines on two work queues, each in its own thread, and
+ * from a plain thread that only tries, checking every element arrives exactly once.
+ *
+ */
+
+#include "test.h"
+#include "co_chan.h"
+#include "co_coroutines.h"
+#include "co_shortcuts.h"
+#include "dep/co_primitive_allocator.h"
+#include <pthread.h>
+#include <string.h>
+
+/** Elements sent by each sender, all of them a multiple of the number of receivers */
+#define CHAN_ITEMS (20000)
+/** Senders, and receivers, per work queue */
+#define CHAN_MT_PER_WQ (2)
+/** Senders in all, the plain thread included */
+#define CHAN_MT_SENDERS (2 * CHAN_MT_PER_WQ + 1)
+/** Elements taken by each receiver */
+#define CHAN_MT_PER_RECEIVER (CHAN_MT_SENDERS * CHAN_ITEMS / (2 * CHAN_MT_PER_WQ))
+
+static co_multi_co_wq_t wq, wq2;
+static co_chan_t ch;
+static co_chan_mt_t mch;
+static unsigned char seen[CHAN_MT_SENDERS * CHAN_ITEMS];
+static int receivers_left;
+
+co_routine_decl(int, sender, int, from, int, to, int, i);
+co_routine_decl(int, receiver, int, n, int, i, int, v, int, bad);
+co_routine_decl(int, mt_sender, int, from, int, i);
+co_routine_decl(int, mt_receiver, int, n, int, v);
+co_routine_decl(int, chan_main, int, unused);
+
+co_yield_rv_t sender(struct sender_co_obj *self) {
+	co_routine_begin(self, sender);
+	for (_(i) = _(from); _(i) < _(to); ++_(i)) {
+		co_yield_chan_send(self, &ch, &_(i));
+	}
+	co_yield_break();
+}
+
+/* Receives n elements, expecting them in order from 0 */
+co_yield_rv_t receiver(struct receiver_co_obj *self) {
+	co_routine_begin(self, receiver);
+	for (_(i) = 0; _(i) < _(n); ++_(i)) {
+		co_yield_chan_recv(self, &ch, &_(v));
+		_(bad) += _(v) != _(i);
+	}
+	co_yield_break();
+}
+
+co_yield_rv_t mt_sender(struct mt_sender_co_obj *self) {
+	co_routine_begin(self, mt_sender);
+	for (_(i) = _(from); _(i) < _(from) + CHAN_ITEMS; ++_(i)) {
+		co_yield_chan_mt_send(self, &mch, &_(i));
+	}
+	co_yield_break();
+}
+
+/* Marks n elements as seen, the last receiver to finish stops both work queues */
+co_yield_rv_t mt_receiver(struct mt_receiver_co_obj *self) {
+	co_routine_begin(self, mt_receiver);
+	for (; _(n); --_(n)) {
+		co_yield_chan_mt_recv(self, &mch, &_(v));
+		++seen[_(v)];
+	}
+	if (!__sync_sub_and_fetch(&receivers_left, 1)) {
+		wq.terminate  = 1;
+		wq2.terminate = 1;
+		co_multi_co_wq_ring_the_bell(&wq);
+		co_multi_co_wq_ring_the_bell(&wq2);
+	}
+	co_yield_break();
+}
+
+/* State of chan_main, kept across yields */
+static struct sender_co_obj snd;
+static struct receiver_co_obj rcv;
+
+/**
+ * Await child in place until it terminates, if it did not yet
+ * @param self Calling coroutine
+ * @param child Child in place
+ */
+#define await_child(self, child)                                                                                       \
+	while (!co_is_terminated(&(child)->obj)) {                                                                         \
+		co_yield_await(self, child);                                                                                   \
+	}
+
+co_yield_rv_t chan_main(struct chan_main_co_obj *self) {
+	co_routine_begin(self, chan_main);
+
+	/* Sender runs ahead by the capacity, then parks until receiver makes room */
+	co_fork_run_inplace(self, &snd, sender, 0, 100);
+	co_yield_return(self, 0);
+	test_check(!co_is_terminated(&snd.obj) && ch.count == ch.cap);
+	co_fork_run_inplace(self, &rcv, receiver, 100);
+	await_child(self, &rcv);
+	await_child(self, &snd);
+	test_check(rcv.args.bad == 0 && ch.count == 0);
+
+	/* Receiver parks on empty channel until sender comes */
+	co_fork_run_inplace(self, &rcv, receiver, 10);
+	co_yield_return(self, 0);
+	test_check(!co_is_terminated(&rcv.obj));
+	co_fork_run_inplace(self, &snd, sender, 0, 10);
+	await_child(self, &snd);
+	await_child(self, &rcv);
+	test_check(rcv.args.bad == 0 && ch.count == 0);
+
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+/**
+ * Plain thread sending by trying, senders on work queues use the other values
+ */
+static void *try_sender(void *unused) {
+	int i;
+	(void)unused;
+	for (i = 2 * CHAN_MT_PER_WQ * CHAN_ITEMS; i < CHAN_MT_SENDERS * CHAN_ITEMS; ++i)
+		while (!co_chan_mt_try_send(NULL, &mch, &i))
+			sched_yield();
+	return NULL;
+}
+
+static void *run(void *arg) {
+	co_multi_co_wq_loop(arg);
+	return NULL;
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	co_multi_co_wq_t *wqs[2];
+	pthread_t th[2];
+	int i, v, missed = 0;
+
+	/* Bad arguments, try on full and empty channel */
+	test_check(co_chan_init(&ch, 0, sizeof(int)) == -EINVAL);
+	test_check(co_chan_mt_init(&mch, 1, 0) == -EINVAL);
+	test_check(!co_chan_init(&ch, 1, sizeof(int)));
+	v = 7;
+	test_check(!co_chan_try_recv(&ch, &v) && v == 7);
+	test_check(co_chan_try_send(&ch, &v) && !co_chan_try_send(&ch, &v));
+	v = 0;
+	test_check(co_chan_try_recv(&ch, &v) && v == 7 && !co_chan_try_recv(&ch, &v));
+	co_chan_destroy(&ch);
+
+	/* Multi thread capacity is rounded up to a power of 2 */
+	test_check(!co_chan_mt_init(&mch, 3, sizeof(int)));
+	for (i = 0; i < 4; ++i)
+		test_check(co_chan_mt_try_send(NULL, &mch, &i));
+	test_check(!co_chan_mt_try_send(NULL, &mch, &i));
+	for (i = 0; i < 4; ++i)
+		test_check(co_chan_mt_try_recv(NULL, &mch, &v) && v == i);
+	test_check(!co_chan_mt_try_recv(NULL, &mch, &v));
+	co_chan_mt_destroy(&mch);
+
+	/* Single work queue */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	test_check(!co_chan_init(&ch, 4, sizeof(int)));
+	{
+		struct chan_main_co_obj *m = co_new(&wq, chan_main, 0);
+		co_schedule(&wq, m);
+	}
+	co_multi_co_wq_loop(&wq);
+	co_chan_destroy(&ch);
+	co_multi_co_wq_destroy(&wq);
+
+	/* Two work queues and a plain thread, small capacity so that both sides park often */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	co_multi_co_wq_init(&wq2, 8, &alloc, &alloc);
+	wqs[0] = &wq;
+	wqs[1] = &wq2;
+	test_check(!co_chan_mt_init(&mch, 4, sizeof(int)));
+	receivers_left = 2 * CHAN_MT_PER_WQ;
+	for (i = 0; i < 2 * CHAN_MT_PER_WQ; ++i) {
+		struct mt_sender_co_obj *s   = co_new(wqs[i % 2], mt_sender, i * CHAN_ITEMS);
+		struct mt_receiver_co_obj *r = co_new(wqs[i % 2], mt_receiver, CHAN_MT_PER_RECEIVER);
+		co_schedule(wqs[i % 2], s);
+		co_schedule(wqs[i % 2], r);
+	}
+	pthread_create(&th[0], NULL, run, &wq2);
+	pthread_create(&th[1], NULL, try_sender, NULL);
+	co_multi_co_wq_loop(&wq);
+	pthread_join(th[0], NULL);
+	pthread_join(th[1], NULL);
+	for (i = 0; i < CHAN_MT_SENDERS * CHAN_ITEMS; ++i)
+		missed += seen[i] != 1;
+	test_check(missed == 0);
+	test_check(!co_chan_mt_try_recv(NULL, &mch, &v));
+	co_chan_mt_destroy(&mch);
+	co_multi_co_wq_destroy(&wq);
+	co_multi_co_wq_destroy(&wq2);
+	return test_report("chan");
+}
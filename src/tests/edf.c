@@ -0,0 +1,154 @@
+/**
+ * @file edf.c
+ *
+ * Earliest deadline first: co_new_deadline, co_fork_deadline and co_set_deadline
+ *
+ * Jobs record the order they run in. Checks coroutines with a deadline run earliest
+ * deadline first, ahead of those without, which still get to run as they age, that
+ * children inherit the deadline of their parent, and that only roots terminating past
+ * their deadline count as deadline misses.
+ *
+ */
+
+#include "test.h"
+#include "co_coroutines.h"
+#include "co_shortcuts.h"
+#include "dep/co_aux.h"
+#include "dep/co_primitive_allocator.h"
+
+/** Nanoseconds per millisecond */
+#define MS (1000000ULL)
+/** Turns of the spinner, well above CO_MULTI_CO_WQ_PRIO_AGING */
+#define EDF_SPINS (4 * CO_MULTI_CO_WQ_PRIO_AGING)
+
+static co_multi_co_wq_t wq;
+static int order[8], norder, expect, spins_left;
+
+co_routine_decl(int, job, int, id);
+co_routine_decl(int, spinner, int, unused);
+co_routine_decl(int, parent, int, unused);
+co_routine_decl(int, miss_parent, int, unused);
+
+/* Records it ran, the last one expected stops the work queue */
+co_yield_rv_t job(struct job_co_obj *self) {
+	co_routine_begin(self, job);
+	order[norder] = _(id);
+	if (++norder == expect)
+		wq.terminate = 1;
+	co_yield_break();
+}
+
+/* Takes EDF_SPINS turns, counting them down in spins_left */
+co_yield_rv_t spinner(struct spinner_co_obj *self) {
+	co_routine_begin(self, spinner);
+	for (spins_left = EDF_SPINS; spins_left; --spins_left) {
+		co_yield_return(self, 0);
+	}
+	co_yield_break();
+}
+
+/* Forks a child without deadline, then one inheriting its own, and runs both */
+co_yield_rv_t parent(struct parent_co_obj *self) {
+	struct job_co_obj *plain, *kid;
+	co_routine_begin(self, parent);
+	plain = co_fork(self, job, 1);
+	co_set_deadline(plain, co_invalid_abstime());
+	kid = co_fork(self, job, 0);
+	test_check(co_abstime_to_ns(&kid->obj.deadline) == co_abstime_to_ns(&self->obj.deadline));
+	co_run(self, plain);
+	co_run(self, kid);
+	co_yield_break();
+}
+
+/**
+ * Absolute time, relative to now
+ * @param ns Nanoseconds from now, negative for the past
+ */
+static co_abstime_t in(long long ns) {
+	co_abstime_t now;
+	co_get_current_time(&now);
+	return co_ns_to_abstime(co_abstime_to_ns(&now) + ns);
+}
+
+/* Child past its deadline terminates while its parent runs, not a miss */
+co_yield_rv_t miss_parent(struct miss_parent_co_obj *self) {
+	struct job_co_obj *late;
+	co_routine_begin(self, miss_parent);
+	late = co_fork_deadline(self, in(-1 * (long long)MS), job, 2);
+	co_run(self, late);
+	co_yield_return(self, 0);
+	co_yield_return(self, 0);
+	co_yield_break();
+}
+
+/**
+ * Schedule root job
+ * @param id Job id
+ * @param ns Deadline in nanoseconds from now, 0 for none
+ */
+static void schedule_job(int id, long long ns) {
+	struct job_co_obj *c = ns ? co_new_deadline(&wq, in(ns), job, id) : co_new(&wq, job, id);
+	co_schedule(&wq, c);
+}
+
+/**
+ * Run work queue until given number of jobs ran
+ * @param n Number of jobs
+ */
+static void run(int n) {
+	norder = 0;
+	expect = n;
+	co_multi_co_wq_loop(&wq);
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+
+	/* Earliest deadline first, ahead of those without, which keep their order */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	schedule_job(4, 0);
+	schedule_job(0, 400 * MS);
+	schedule_job(1, 100 * MS);
+	schedule_job(5, 0);
+	schedule_job(2, 300 * MS);
+	schedule_job(3, 200 * MS);
+	run(6);
+	test_check(order[0] == 1 && order[1] == 3 && order[2] == 2 && order[3] == 0 && order[4] == 4 && order[5] == 5);
+	test_check(wq.deadline_misses == 0);
+	co_multi_co_wq_destroy(&wq);
+
+	/* Children inherit deadline, unless it is cleared */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	{
+		struct parent_co_obj *p = co_new_deadline(&wq, in(1000 * MS), parent, 0);
+		co_schedule(&wq, p);
+	}
+	run(2);
+	test_check(order[0] == 0 && order[1] == 1);
+	co_multi_co_wq_destroy(&wq);
+
+	/* Levels still get to run as they age, with a coroutine with a deadline queued all the time */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	{
+		struct spinner_co_obj *s = co_new_deadline(&wq, in(1000 * MS), spinner, 0);
+		co_schedule(&wq, s);
+	}
+	schedule_job(0, 0);
+	run(1);
+	test_check(spins_left > 0 && spins_left < EDF_SPINS);
+	co_multi_co_wq_destroy(&wq);
+
+	/* Roots past their deadline are misses, children while their parent runs are not */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	schedule_job(0, -1 * (long long)MS);
+	schedule_job(1, 1000 * MS);
+	{
+		struct miss_parent_co_obj *p = co_new(&wq, miss_parent, 0);
+		co_schedule(&wq, p);
+	}
+	schedule_job(3, 0);
+	run(4);
+	test_check(wq.deadline_misses == 1);
+	co_multi_co_wq_destroy(&wq);
+	return test_report("edf");
+}
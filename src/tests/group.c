@@ -0,0 +1,139 @@
+/**
+ * @file group.c
+ *
+ * Await groups: co_yield_await_all, co_yield_await_any and co_yield_await_rest
+ *
+ * Children run in place for a given number of turns, recording the order they terminate
+ * in. Checks the caller is resumed once, when the last, or the first, of them terminates,
+ * that children terminated before the group was armed count as done, and that children
+ * force terminated from elsewhere count down the group like any other.
+ *
+ */
+
+#include "test.h"
+#include "co_coroutines.h"
+#include "co_shortcuts.h"
+#include "dep/co_primitive_allocator.h"
+
+/** Children per group */
+#define GROUP_N (3)
+
+static co_multi_co_wq_t wq;
+static int order[GROUP_N], norder, forever;
+
+co_routine_decl(int, worker, int, id, int, turns);
+co_routine_decl(int, killer, int, unused);
+co_routine_decl(int, group_main, int, idx, co_await_group_t, grp);
+
+/* Yields for given number of turns, or for as long as forever is set, then records it terminated */
+co_yield_rv_t worker(struct worker_co_obj *self) {
+	co_routine_begin(self, worker);
+	for (; _(turns); --_(turns)) {
+		co_yield_return(self, 0);
+		if (forever)
+			++_(turns);
+	}
+	order[norder++] = _(id);
+	co_yield_break();
+}
+
+/* State of group_main, kept across yields */
+static struct worker_co_obj kids[GROUP_N];
+static struct worker_co_obj *kidp[GROUP_N] = {&kids[0], &kids[1], &kids[2]};
+
+/* Force terminates all children, each counts down the group once taken out of the queue */
+co_yield_rv_t killer(struct killer_co_obj *self) {
+	int i;
+	co_routine_begin(self, killer);
+	for (i = 0; i < GROUP_N; ++i)
+		co_force_terminate(&kids[i].obj);
+	co_yield_break();
+}
+
+/**
+ * Fork all children in place
+ * @param self Calling coroutine
+ * @param t0, t1, t2 Turns of each child
+ */
+#define fork_kids(self, t0, t1, t2)                                                                                    \
+	{                                                                                                                  \
+		norder = 0;                                                                                                    \
+		co_fork_run_inplace(self, &kids[0], worker, 0, t0);                                                            \
+		co_fork_run_inplace(self, &kids[1], worker, 1, t1);                                                            \
+		co_fork_run_inplace(self, &kids[2], worker, 2, t2);                                                            \
+	}
+
+/** Check whether all children terminated */
+static int all_terminated(void) {
+	int i;
+	for (i = 0; i < GROUP_N; ++i)
+		if (!co_is_terminated(&kids[i].obj))
+			return 0;
+	return 1;
+}
+
+co_yield_rv_t group_main(struct group_main_co_obj *self) {
+	co_routine_begin(self, group_main);
+
+	/* All: resumed once the last one terminates */
+	fork_kids(self, 6, 2, 4);
+	co_yield_await_all(self, &_(grp), GROUP_N, kidp);
+	test_check(all_terminated() && norder == 3);
+	test_check(order[0] == 1 && order[1] == 2 && order[2] == 0);
+	test_check(_(grp).pending == 0 && _(grp).first == &kids[1].obj);
+
+	/* All, one terminated before the group is armed: counts as first, the others still awaited */
+	fork_kids(self, 3, 0, 5);
+	co_yield_return(self, 0);
+	test_check(co_is_terminated(&kids[1].obj) && !co_is_terminated(&kids[0].obj));
+	co_yield_await_all(self, &_(grp), GROUP_N, kidp);
+	test_check(all_terminated() && _(grp).first == &kids[1].obj);
+	test_check(order[1] == 0 && order[2] == 2);
+
+	/* All, every one terminated already: nothing pending, first in order of the array */
+	co_yield_await_all(self, &_(grp), GROUP_N, kidp);
+	test_check(_(grp).pending == 0 && _(grp).first == &kids[0].obj);
+
+	/* Any: resumed with the first to terminate, others go on, awaited as the rest */
+	fork_kids(self, 5, 7, 1);
+	co_yield_await_any(self, &_(grp), GROUP_N, kidp, _(idx));
+	test_check(_(idx) == 2 && norder == 1 && order[0] == 2);
+	test_check(!co_is_terminated(&kids[0].obj) && !co_is_terminated(&kids[1].obj) && _(grp).pending == 2);
+	co_yield_await_rest(self, &_(grp));
+	test_check(all_terminated() && norder == 3 && order[1] == 0 && order[2] == 1);
+
+	/* Any, one terminated before: index of that one, without yield */
+	fork_kids(self, 2, 2, 0);
+	co_yield_return(self, 0);
+	co_yield_await_any(self, &_(grp), GROUP_N, kidp, _(idx));
+	test_check(_(idx) == 2 && norder == 1);
+	co_yield_await_rest(self, &_(grp));
+	test_check(all_terminated());
+
+	/* Any, no children: index is n */
+	co_yield_await_any(self, &_(grp), 0, kidp, _(idx));
+	test_check(_(idx) == 0);
+
+	/* Children force terminated by another coroutine count down the group */
+	forever = 1;
+	fork_kids(self, 1, 1, 1);
+	co_fork_run(self, killer, 0);
+	co_yield_await_all(self, &_(grp), GROUP_N, kidp);
+	test_check(all_terminated() && norder == 0 && _(grp).pending == 0);
+	forever = 0;
+
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	struct group_main_co_obj *m;
+
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	m = co_new(&wq, group_main, 0, {0});
+	co_schedule(&wq, m);
+	co_multi_co_wq_loop(&wq);
+	co_multi_co_wq_destroy(&wq);
+	return test_report("group");
+}
@@ -0,0 +1,278 @@
+/**
+ * @file io.c
+ *
+ * Read, write, accept and connect on a pipe, a regular file and a loopback socket
+ *
+ * Checks results and errors, and cancellation of a coroutine whose operation is pending,
+ * which takes the cancellation once the operation completes. Built once per backend:
+ * io_uring (uring), helper threads (threads), and epoll (epoll), where coroutines wait
+ * for readiness with co_yield_wait_fd and do the system call themselves. Regular files
+ * cannot be watched by epoll, there the wait fails with EPERM and the call goes on.
+ *
+ */
+
+#include "test.h"
+#include "co_coroutines.h"
+#include "co_io.h"
+#include "co_shortcuts.h"
+#include "dep/co_primitive_allocator.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(TEST_IO_URING)
+#	define IO_NAME "io-uring"
+#	define IO_RING_ENTRIES (64)
+#elif defined(TEST_IO_EPOLL)
+#	define IO_NAME "io-epoll"
+#else
+#	define IO_NAME "io-threads"
+#endif
+
+#ifndef IO_RING_ENTRIES
+#	define IO_RING_ENTRIES (0)
+#endif
+
+/* Operations under test, with epoll a wait for readiness, then the system call */
+#ifdef TEST_IO_EPOLL
+#	define io_read(self, req, fd, buf, len, off)                                                                       \
+		{                                                                                                              \
+			co_yield_wait_fd(self, fd, EPOLLIN);                                                                       \
+			(req)->res = io_res((off) < 0 ? read(fd, buf, len) : pread(fd, buf, len, off));                            \
+		}
+#	define io_write(self, req, fd, buf, len, off)                                                                      \
+		{                                                                                                              \
+			co_yield_wait_fd(self, fd, EPOLLOUT);                                                                      \
+			(req)->res = io_res((off) < 0 ? write(fd, buf, len) : pwrite(fd, buf, len, off));                          \
+		}
+#	define io_accept(self, req, fd)                                                                                    \
+		{                                                                                                              \
+			co_yield_wait_fd(self, fd, EPOLLIN);                                                                       \
+			(req)->res = io_res(accept(fd, NULL, NULL));                                                               \
+		}
+/** Sockets are non blocking, to be waited for */
+#	define IO_SOCK_FLAGS SOCK_NONBLOCK
+#else
+#	define io_read(self, req, fd, buf, len, off) co_yield_read(self, req, fd, buf, len, off)
+#	define io_write(self, req, fd, buf, len, off) co_yield_write(self, req, fd, buf, len, off)
+#	define io_accept(self, req, fd) co_yield_accept(self, req, fd, NULL, NULL)
+#	define IO_SOCK_FLAGS 0
+#endif
+
+static co_multi_co_wq_t wq;
+static co_io_t io;
+
+#ifdef TEST_IO_EPOLL
+/**
+ * Result of system call, as the other backends report it
+ * @param rv Return value of system call
+ * @return rv, or negative error code
+ */
+static long io_res(long rv) { return rv < 0 ? -(long)errno : rv; }
+#endif
+
+co_routine_decl(int, reader, int, fd, int, cancelled, co_io_req_t, req, char, buf[16]);
+co_routine_decl(int, acceptor, int, fd, co_io_req_t, req);
+co_routine_decl(int, connector, struct sockaddr_in *, addr, int, fd, long, res);
+co_routine_decl(int, io_main, int, unused);
+
+/* Reads once, or records what the pending read got if cancelled meanwhile */
+co_yield_rv_t reader(struct reader_co_obj *self) {
+	co_routine_begin(self, reader);
+	co_on_cancel(self) {
+		_(cancelled) = 1;
+	}
+	io_read(self, &_(req), _(fd), _(buf), sizeof(_(buf)), -1);
+	co_yield_break();
+}
+
+co_yield_rv_t acceptor(struct acceptor_co_obj *self) {
+	co_routine_begin(self, acceptor);
+	io_accept(self, &_(req), _(fd));
+	co_yield_break();
+}
+
+/* Connects a socket, res is 0 or negative error code */
+co_yield_rv_t connector(struct connector_co_obj *self) {
+	co_routine_begin(self, connector);
+	_(fd) = socket(AF_INET, SOCK_STREAM | IO_SOCK_FLAGS, 0);
+	if (!connect(_(fd), (struct sockaddr *)_(addr), sizeof(*_(addr)))) {
+		_(res) = 0;
+	} else if (errno != EINPROGRESS) {
+		_(res) = -errno; /* Blocking connect is done right away on loopback */
+	} else {
+#ifdef TEST_IO_EPOLL
+		co_yield_wait_fd(self, _(fd), EPOLLOUT);
+#endif
+		{
+			int err       = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(_(fd), SOL_SOCKET, SO_ERROR, &err, &len);
+			_(res) = -err;
+		}
+	}
+	co_yield_break();
+}
+
+/* State of io_main, kept across yields */
+static int pipefd[2], filefd, lsn, srv;
+static struct sockaddr_in addr;
+static co_io_req_t req;
+static char buf[16];
+static struct reader_co_obj rd;
+static struct acceptor_co_obj ac;
+static struct connector_co_obj cn;
+
+/**
+ * Await child in place until it terminates, if it did not yet
+ * @param self Calling coroutine
+ * @param child Child in place
+ */
+#define await_child(self, child)                                                                                       \
+	while (!co_is_terminated(&(child)->obj)) {                                                                         \
+		co_yield_await(self, child);                                                                                   \
+	}
+
+/**
+ * Open loopback listening socket on any free port
+ * @return Socket, address is in addr
+ */
+static int listen_loopback(void) {
+	socklen_t len = sizeof(addr);
+	int fd        = socket(AF_INET, SOCK_STREAM | IO_SOCK_FLAGS, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 8) ||
+	    getsockname(fd, (struct sockaddr *)&addr, &len)) {
+		perror("listen");
+		exit(1);
+	}
+	return fd;
+}
+
+co_yield_rv_t io_main(struct io_main_co_obj *self) {
+	co_routine_begin(self, io_main);
+
+	/* Pipe: a pending read completes on write, then end of file */
+	test_check(!pipe(pipefd));
+	co_fork_run_inplace(self, &rd, reader, pipefd[0]);
+	co_yield_return(self, 0);
+	test_check(!co_is_terminated(&rd.obj));
+	io_write(self, &req, pipefd[1], "hello", 5, -1);
+	test_check(req.res == 5);
+	await_child(self, &rd);
+	test_check(rd.args.req.res == 5 && !memcmp(rd.args.buf, "hello", 5));
+	close(pipefd[1]);
+	io_read(self, &req, pipefd[0], buf, sizeof(buf), -1);
+	test_check(req.res == 0);
+
+	/* Pipe errors: write with no reader, bad fd */
+	test_check(!pipe(pipefd));
+	close(pipefd[0]);
+	io_write(self, &req, pipefd[1], "x", 1, -1);
+	test_check(req.res == -EPIPE);
+	close(pipefd[1]);
+	io_read(self, &req, -1, buf, sizeof(buf), -1);
+	test_check(req.res == -EBADF);
+
+	/* Cancelled while read is pending, takes it once the read completes */
+	test_check(!pipe(pipefd));
+	co_fork_run_inplace(self, &rd, reader, pipefd[0]);
+	co_yield_return(self, 0);
+	co_cancel(self, &rd);
+	co_yield_return(self, 0);
+	test_check(!co_is_terminated(&rd.obj) && !rd.args.cancelled);
+	test_check(write(pipefd[1], "c", 1) == 1);
+	await_child(self, &rd);
+	test_check(co_is_cancelled(&rd.obj) && rd.args.cancelled);
+#ifdef TEST_IO_EPOLL
+	test_check(rd.args.req.res == 0 && read(pipefd[0], buf, 1) == 1); /* Woken up as ready, data is still there */
+#else
+	test_check(rd.args.req.res == 1);
+#endif
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	/* Regular file: positioned and sequential access, end of file, wrong mode */
+	{
+		char path[] = "/tmp/co_io_test_XXXXXX";
+		filefd      = mkstemp(path);
+		unlink(path);
+	}
+	io_write(self, &req, filefd, "0123456789", 10, 0);
+	test_check(req.res == 10);
+	io_read(self, &req, filefd, buf, 3, 4);
+	test_check(req.res == 3 && !memcmp(buf, "456", 3));
+	io_read(self, &req, filefd, buf, sizeof(buf), 100);
+	test_check(req.res == 0);
+	lseek(filefd, 8, SEEK_SET);
+	io_read(self, &req, filefd, buf, sizeof(buf), -1);
+	test_check(req.res == 2 && !memcmp(buf, "89", 2));
+	close(filefd);
+	filefd = open("/dev/null", O_RDONLY);
+	io_write(self, &req, filefd, "x", 1, -1);
+	test_check(req.res == -EBADF);
+	close(filefd);
+
+	/* Loopback socket: accept while connecting, then both ways */
+	lsn = listen_loopback();
+	co_fork_run_inplace(self, &ac, acceptor, lsn);
+	co_fork_run_inplace(self, &cn, connector, &addr);
+	await_child(self, &cn);
+	test_check(cn.args.res == 0);
+	await_child(self, &ac);
+	test_check(ac.args.req.res >= 0);
+	srv = ac.args.req.res;
+	io_write(self, &req, cn.args.fd, "ping", 4, -1);
+	test_check(req.res == 4);
+	io_read(self, &req, srv, buf, sizeof(buf), -1);
+	test_check(req.res == 4 && !memcmp(buf, "ping", 4));
+	io_write(self, &req, srv, "pong", 4, -1);
+	test_check(req.res == 4);
+	io_read(self, &req, cn.args.fd, buf, sizeof(buf), -1);
+	test_check(req.res == 4 && !memcmp(buf, "pong", 4));
+	close(cn.args.fd);
+	io_read(self, &req, srv, buf, sizeof(buf), -1);
+	test_check(req.res == 0);
+	close(srv);
+
+	/* Socket errors: connect to a closed port, accept on a socket not listening */
+	close(lsn);
+	co_fork_run_inplace(self, &cn, connector, &addr);
+	await_child(self, &cn);
+	test_check(cn.args.res == -ECONNREFUSED);
+	close(cn.args.fd);
+	lsn = socket(AF_INET, SOCK_STREAM | IO_SOCK_FLAGS, 0);
+	io_accept(self, &req, lsn);
+	test_check(req.res == -EINVAL);
+	close(lsn);
+
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	struct io_main_co_obj *m;
+
+	signal(SIGPIPE, SIG_IGN);
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	if (co_io_init(&io, &wq, IO_RING_ENTRIES, 4)) {
+		printf("%s: cannot initialize I/O\n", IO_NAME);
+		return 1;
+	}
+#ifdef TEST_IO_URING
+	test_check(io.use_ring);
+#endif
+	m = co_new(&wq, io_main, 0);
+	co_schedule(&wq, m);
+	co_multi_co_wq_loop(&wq);
+	test_check(!io.base.inflight);
+	co_io_destroy(&io, &wq);
+	co_multi_co_wq_destroy(&wq);
+	return test_report(IO_NAME);
+}
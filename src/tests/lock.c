@@ -0,0 +1,251 @@
+/**
+ * @file lock.c
+ *
+ * Semaphore, mutex and readers-writer lock
+ *
+ * On a single work queue, contenders run in place and hold for a given number of turns,
+ * recording the order they get the lock in: checks the number of holders, FIFO hand over,
+ * that newcomers cannot barge in, and the readers-writer lock rules. Then coroutines on
+ * two work queues, each in its own thread, update shared state under a mutex and under a
+ * readers-writer lock, yielding while holding, and readers check it is consistent.
+ *
+ */
+
+#include "test.h"
+#include "co_coroutines.h"
+#include "co_lock.h"
+#include "co_shortcuts.h"
+#include "dep/co_primitive_allocator.h"
+#include <pthread.h>
+
+/** Contenders on a single work queue */
+#define LOCK_N (4)
+/** Coroutines per work queue, and updates each, under contention */
+#define LOCK_MT_PER_WQ (8)
+#define LOCK_MT_ROUNDS (2000)
+
+/** Kinds of lock a holder takes */
+enum { LOCK_SEM, LOCK_MUTEX, LOCK_RD, LOCK_WR };
+
+static co_multi_co_wq_t wq, wq2;
+static co_semaphore_t sem;
+static co_mutex_t mtx;
+static co_rwlock_t rw;
+static int order[LOCK_N], norder, holding, max_holding, readers, writers, bad;
+/** Pairs updated in separate turns, under the mutex and under the readers-writer lock */
+static long mtx_a, mtx_b, rw_a, rw_b;
+static int left;
+
+co_routine_decl(int, holder, int, id, int, kind, int, turns);
+co_routine_decl(int, mt_worker, int, writer, int, i);
+co_routine_decl(int, lock_main, int, unused);
+
+/* Takes a lock, records it, holds it for given number of turns, then gives it back */
+co_yield_rv_t holder(struct holder_co_obj *self) {
+	co_routine_begin(self, holder);
+	switch (_(kind)) {
+	case LOCK_SEM:
+		co_yield_acquire(self, &sem);
+		break;
+	case LOCK_MUTEX:
+		co_yield_lock(self, &mtx);
+		break;
+	case LOCK_RD:
+		co_yield_rdlock(self, &rw);
+		++readers;
+		break;
+	default:
+		co_yield_wrlock(self, &rw);
+		++writers;
+		break;
+	}
+	order[norder++] = _(id);
+	if (++holding > max_holding)
+		max_holding = holding;
+	bad += writers > 1 || (writers && readers);
+	for (; _(turns); --_(turns)) {
+		co_yield_return(self, 0);
+	}
+	--holding;
+	switch (_(kind)) {
+	case LOCK_SEM:
+		co_release(self, &sem);
+		break;
+	case LOCK_MUTEX:
+		co_unlock(self, &mtx);
+		break;
+	case LOCK_RD:
+		--readers;
+		co_rdunlock(self, &rw);
+		break;
+	default:
+		--writers;
+		co_wrunlock(self, &rw);
+		break;
+	}
+	co_yield_break();
+}
+
+/* Mutex writers, or readers and writers in turn, the last one to finish stops both work queues */
+co_yield_rv_t mt_worker(struct mt_worker_co_obj *self) {
+	co_routine_begin(self, mt_worker);
+	for (_(i) = 0; _(i) < LOCK_MT_ROUNDS; ++_(i)) {
+		if (_(writer)) {
+			co_yield_lock(self, &mtx);
+			++mtx_a;
+			co_yield_return(self, 0);
+			++mtx_b;
+			co_unlock(self, &mtx);
+		} else if (_(i) & 1) {
+			co_yield_rdlock(self, &rw);
+			co_yield_return(self, 0);
+			__sync_fetch_and_add(&bad, rw_a != rw_b);
+			co_rdunlock(self, &rw);
+		} else {
+			co_yield_wrlock(self, &rw);
+			++rw_a;
+			co_yield_return(self, 0);
+			++rw_b;
+			co_wrunlock(self, &rw);
+		}
+	}
+	if (!__sync_sub_and_fetch(&left, 1)) {
+		wq.terminate  = 1;
+		wq2.terminate = 1;
+		co_multi_co_wq_ring_the_bell(&wq);
+		co_multi_co_wq_ring_the_bell(&wq2);
+	}
+	co_yield_break();
+}
+
+/* State of lock_main, kept across yields */
+static struct holder_co_obj hs[LOCK_N];
+
+/** Check whether all contenders terminated */
+static int holders_done(void) {
+	int i;
+	for (i = 0; i < LOCK_N; ++i)
+		if (!co_is_terminated(&hs[i].obj))
+			return 0;
+	return 1;
+}
+
+/**
+ * Let contenders run until all of them terminated
+ * Contenders are not awaited, so that they take turns with each other rather than with the caller.
+ * @param self Calling coroutine
+ */
+#define run_holders(self)                                                                                              \
+	while (!holders_done()) {                                                                                          \
+		co_yield_return(self, 0);                                                                                      \
+	}
+
+/** Reset record of who got the lock */
+static void reset(void) {
+	norder      = 0;
+	holding     = 0;
+	max_holding = 0;
+}
+
+co_yield_rv_t lock_main(struct lock_main_co_obj *self) {
+	co_routine_begin(self, lock_main);
+
+	/* Semaphore of 2 permits: at most 2 holders, the others get in FIFO order */
+	reset();
+	co_fork_run_inplace(self, &hs[0], holder, 0, LOCK_SEM, 5);
+	co_fork_run_inplace(self, &hs[1], holder, 1, LOCK_SEM, 3);
+	co_fork_run_inplace(self, &hs[2], holder, 2, LOCK_SEM, 1);
+	co_fork_run_inplace(self, &hs[3], holder, 3, LOCK_SEM, 1);
+	run_holders(self);
+	test_check(max_holding == 2 && norder == 4);
+	test_check(order[0] == 0 && order[1] == 1 && order[2] == 2 && order[3] == 3);
+	test_check(co_atom_peek(&sem.count) == 2 && co_semaphore_try_acquire(&sem) && co_semaphore_try_acquire(&sem));
+	test_check(!co_semaphore_try_acquire(&sem));
+	co_release(self, &sem);
+	co_release(self, &sem);
+
+	/* Mutex: contenders park in FIFO order, unlock hands over, newcomer cannot barge in */
+	reset();
+	test_check(co_mutex_try_lock(&mtx) && !co_mutex_try_lock(&mtx));
+	co_fork_run_inplace(self, &hs[0], holder, 0, LOCK_MUTEX, 1);
+	co_fork_run_inplace(self, &hs[1], holder, 1, LOCK_MUTEX, 1);
+	co_fork_run_inplace(self, &hs[2], holder, 2, LOCK_MUTEX, 1);
+	co_yield_return(self, 0);
+	test_check(norder == 0);
+	co_unlock(self, &mtx);
+	test_check(!co_mutex_try_lock(&mtx));
+	co_fork_run_inplace(self, &hs[3], holder, 3, LOCK_MUTEX, 0);
+	run_holders(self);
+	test_check(max_holding == 1 && norder == 4);
+	test_check(order[0] == 0 && order[1] == 1 && order[2] == 2 && order[3] == 3);
+	test_check(co_mutex_try_lock(&mtx));
+	co_unlock(self, &mtx);
+
+	/* Readers-writer lock: readers share, a waiting writer holds off new readers */
+	reset();
+	co_fork_run_inplace(self, &hs[0], holder, 0, LOCK_RD, 4);
+	co_fork_run_inplace(self, &hs[1], holder, 1, LOCK_RD, 4);
+	co_fork_run_inplace(self, &hs[2], holder, 2, LOCK_WR, 2);
+	co_yield_return(self, 0);
+	test_check(norder == 2 && !co_rwlock_try_rdlock(&rw) && !co_rwlock_try_wrlock(&rw));
+	co_fork_run_inplace(self, &hs[3], holder, 3, LOCK_RD, 1);
+	run_holders(self);
+	test_check(max_holding == 2 && norder == 4 && order[2] == 2 && order[3] == 3);
+
+	/* Writer unlock hands over to all waiting readers first, then to the next writer */
+	reset();
+	test_check(co_rwlock_try_wrlock(&rw));
+	co_fork_run_inplace(self, &hs[0], holder, 0, LOCK_WR, 1);
+	co_fork_run_inplace(self, &hs[1], holder, 1, LOCK_RD, 2);
+	co_fork_run_inplace(self, &hs[2], holder, 2, LOCK_RD, 2);
+	co_fork_run_inplace(self, &hs[3], holder, 3, LOCK_WR, 1);
+	co_yield_return(self, 0);
+	test_check(norder == 0);
+	co_wrunlock(self, &rw);
+	run_holders(self);
+	test_check(max_holding == 2 && norder == 4);
+	test_check(order[0] == 1 && order[1] == 2 && order[2] == 0 && order[3] == 3);
+	test_check(co_atom_peek(&rw.state) == 0 && bad == 0);
+
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+static void *run(void *arg) {
+	co_multi_co_wq_loop(arg);
+	return NULL;
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	struct lock_main_co_obj *m;
+	pthread_t th;
+	int i;
+
+	sem = co_semaphore_init(2);
+	mtx = co_mutex_init();
+	rw  = co_rwlock_init();
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	m = co_new(&wq, lock_main, 0);
+	co_schedule(&wq, m);
+	co_multi_co_wq_loop(&wq);
+	co_multi_co_wq_destroy(&wq);
+
+	/* Two work queues, half the coroutines on the mutex, half on the readers-writer lock */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	co_multi_co_wq_init(&wq2, 8, &alloc, &alloc);
+	left = 2 * LOCK_MT_PER_WQ;
+	for (i = 0; i < 2 * LOCK_MT_PER_WQ; ++i) {
+		co_multi_co_wq_t *w        = i & 1 ? &wq2 : &wq;
+		struct mt_worker_co_obj *c = co_new(w, mt_worker, i < LOCK_MT_PER_WQ);
+		co_schedule(w, c);
+	}
+	pthread_create(&th, NULL, run, &wq2);
+	co_multi_co_wq_loop(&wq);
+	pthread_join(th, NULL);
+	test_check(bad == 0 && mtx_a == LOCK_MT_PER_WQ * LOCK_MT_ROUNDS && mtx_b == mtx_a);
+	test_check(rw_a == LOCK_MT_PER_WQ * LOCK_MT_ROUNDS / 2 && rw_b == rw_a);
+	co_multi_co_wq_destroy(&wq);
+	co_multi_co_wq_destroy(&wq2);
+	return test_report("lock");
+}
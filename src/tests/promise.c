@@ -0,0 +1,140 @@
+/**
+ * @file promise.c
+ *
+ * Promise set before it is awaited, while awaited, from a coroutine or a foreign thread
+ *
+ * Checks the awaiting coroutine gets the value, once, and that a promise set before it is
+ * awaited costs no yield. Then a foreign thread sets the promises of many coroutines, racing
+ * with them as they come to await, and each of them must wake up with its own value.
+ *
+ */
+
+#include "test.h"
+#include "co_coroutines.h"
+#include "co_promise.h"
+#include "co_shortcuts.h"
+#include "dep/co_primitive_allocator.h"
+#include <pthread.h>
+#include <unistd.h>
+
+/** Coroutines whose promises the foreign thread sets */
+#define PROMISE_N (1000)
+
+static co_multi_co_wq_t wq;
+static int turns, left, bad;
+static void *values[PROMISE_N];
+static co_promise_t *promises[PROMISE_N];
+
+co_routine_decl(int, setter, co_promise_t *, p, void *, value);
+co_routine_decl(int, ticker, int, unused);
+co_routine_decl(int, awaiter, int, id, co_promise_t, p);
+co_routine_decl(int, promise_main, co_promise_t, p);
+
+co_yield_rv_t setter(struct setter_co_obj *self) {
+	co_routine_begin(self, setter);
+	co_promise_set(_(p), _(value));
+	co_yield_break();
+}
+
+/* Counts turns of the work queue, for as long as promise_main runs */
+co_yield_rv_t ticker(struct ticker_co_obj *self) {
+	co_routine_begin(self, ticker);
+	while (!wq.terminate) {
+		++turns;
+		co_yield_return(self, 0);
+	}
+	co_yield_break();
+}
+
+/* Awaits its promise, expecting its own value; the last one stops the work queue */
+co_yield_rv_t awaiter(struct awaiter_co_obj *self) {
+	co_routine_begin(self, awaiter);
+	if (_(id) & 1) {
+		co_yield_return(self, 0); /* Some come late, some early */
+	}
+	co_yield_await_promise(self, &_(p));
+	bad += co_promise_value(&_(p)) != &values[_(id)];
+	if (!--left)
+		wq.terminate = 1;
+	co_yield_break();
+}
+
+/**
+ * Foreign thread setting a promise after a while
+ */
+static void *late_setter(void *p) {
+	usleep(10000);
+	co_promise_set(p, &turns);
+	return NULL;
+}
+
+/**
+ * Foreign thread setting all promises of awaiters, as they come
+ */
+static void *all_setter(void *unused) {
+	int i;
+	(void)unused;
+	for (i = 0; i < PROMISE_N; ++i)
+		co_promise_set(promises[i], &values[i]);
+	return NULL;
+}
+
+/* State of promise_main, kept across yields */
+static pthread_t th;
+static int before;
+
+co_yield_rv_t promise_main(struct promise_main_co_obj *self) {
+	co_routine_begin(self, promise_main);
+	co_fork_run(self, ticker, 0);
+
+	/* Set before awaited: no yield at all */
+	co_promise_set(&_(p), &before);
+	before = turns;
+	co_yield_await_promise(self, &_(p));
+	test_check(co_promise_is_set(&_(p)) && co_promise_value(&_(p)) == &before && turns == before);
+
+	/* Set by another coroutine while awaited */
+	_(p) = co_promise_init();
+	test_check(!co_promise_is_set(&_(p)));
+	co_fork_run(self, setter, &_(p), &left);
+	co_yield_await_promise(self, &_(p));
+	test_check(co_promise_is_set(&_(p)) && co_promise_value(&_(p)) == &left);
+
+	/* Set by a foreign thread while awaited, other coroutines go on meanwhile */
+	_(p)   = co_promise_init();
+	before = turns;
+	pthread_create(&th, NULL, late_setter, &_(p));
+	co_yield_await_promise(self, &_(p));
+	test_check(co_promise_is_set(&_(p)) && co_promise_value(&_(p)) == &turns && turns > before);
+	pthread_join(th, NULL);
+
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	struct promise_main_co_obj *m;
+	int i;
+
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	m = co_new(&wq, promise_main, co_promise_init());
+	co_schedule(&wq, m);
+	co_multi_co_wq_loop(&wq);
+	co_multi_co_wq_destroy(&wq);
+
+	/* Foreign thread racing with awaiters */
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	left = PROMISE_N;
+	for (i = 0; i < PROMISE_N; ++i) {
+		struct awaiter_co_obj *c = co_new(&wq, awaiter, i, co_promise_init());
+		promises[i]              = &c->args.p;
+		co_schedule(&wq, c);
+	}
+	pthread_create(&th, NULL, all_setter, NULL);
+	co_multi_co_wq_loop(&wq);
+	pthread_join(th, NULL);
+	test_check(bad == 0 && left == 0);
+	co_multi_co_wq_destroy(&wq);
+	return test_report("promise");
+}
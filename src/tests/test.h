@@ -0,0 +1,37 @@
+#ifndef CO_TEST_H
+#define CO_TEST_H
+/**
+ * @file test.h
+ *
+ * Helpers shared by tests, see test target of Makefile
+ *
+ */
+
+#include <stdio.h>
+
+/** Number of failed checks */
+static int test_failures;
+
+/**
+ * Check condition, report it if it does not hold, and go on
+ * @param cond Condition expected to hold
+ */
+#define test_check(cond)                                                                                               \
+	do {                                                                                                               \
+		if (!(cond)) {                                                                                                 \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                   \
+			++test_failures;                                                                                           \
+		}                                                                                                              \
+	} while (0)
+
+/**
+ * Report result of test
+ * @param name Test name
+ * @return Exit code, 0 if all checks held
+ */
+static __inline__ int test_report(const char *name) {
+	printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+	return test_failures != 0;
+}
+
+#endif /*CO_TEST_H*/
@@ -0,0 +1,120 @@
+/**
+ * @file timeout.c
+ *
+ * Await with deadline: co_yield_await_timeout and co_await_timed_out
+ *
+ * A target in place yields values after a delay, or terminates. Checks the caller is
+ * resumed by whichever comes first, the target or the deadline, telling which one by
+ * co_await_timed_out, that once timed out it is off the await list of the target, which
+ * goes on undisturbed, and that a cancelled caller leaves its deadline behind.
+ *
+ */
+
+#include "test.h"
+#include "co_coroutines.h"
+#include "co_shortcuts.h"
+#include "dep/co_aux.h"
+#include "dep/co_primitive_allocator.h"
+#include "dep/co_timeout.h"
+
+/** Nanoseconds per millisecond */
+#define MS (1000000UL)
+
+static co_multi_co_wq_t wq;
+
+co_routine_decl(int, target, co_nanosec_t, delay, int, n, int, i);
+co_routine_decl(int, waiter, struct target_co_obj *, t, int, handled);
+co_routine_decl(int, timeout_main, int, unused);
+
+/* Yields 1 to n, each after a delay, then terminates */
+co_yield_rv_t target(struct target_co_obj *self) {
+	co_routine_begin(self, target);
+	for (_(i) = 1; _(i) <= _(n); ++_(i)) {
+		co_yield_wait_timeout(self, _(delay));
+		co_yield_return(self, _(i));
+	}
+	co_yield_break();
+}
+
+/* Awaits target with a deadline far off, until cancelled */
+co_yield_rv_t waiter(struct waiter_co_obj *self) {
+	co_routine_begin(self, waiter);
+	co_on_cancel(self) {
+		++_(handled);
+	}
+	co_yield_await_timeout(self, _(t), 1000 * MS);
+	co_yield_break();
+}
+
+/**
+ * Milliseconds since given time
+ */
+static unsigned long ms_since(const co_abstime_t *t0) {
+	co_abstime_t now;
+	co_get_current_time(&now);
+	return (co_abstime_to_ns(&now) - co_abstime_to_ns(t0)) / MS;
+}
+
+/* State of timeout_main, kept across yields */
+static struct target_co_obj tg;
+static struct waiter_co_obj wt;
+static co_abstime_t t0;
+
+co_yield_rv_t timeout_main(struct timeout_main_co_obj *self) {
+	co_routine_begin(self, timeout_main);
+
+	/* Target yields before the deadline */
+	co_fork_run_inplace(self, &tg, target, 20 * MS, 3);
+	co_get_current_time(&t0);
+	co_yield_await_timeout(self, &tg, 500 * MS);
+	test_check(!co_await_timed_out(self) && tg.rv == 1 && ms_since(&t0) < 500);
+
+	/* Deadline comes first, target goes on without the caller */
+	co_yield_await_timeout(self, &tg, 1 * MS);
+	test_check(co_await_timed_out(self) && tg.rv == 1);
+	test_check(tg.obj.await == NULL && !co_is_terminated(&tg.obj));
+	co_yield_await(self, &tg);
+	test_check(tg.rv == 2);
+
+	/* Target yields again, flag of the previous timeout is cleared */
+	co_yield_await_timeout(self, &tg, 500 * MS);
+	test_check(!co_await_timed_out(self) && tg.rv == 3);
+
+	/* Target terminates before the deadline */
+	co_yield_await_timeout(self, &tg, 500 * MS);
+	test_check(!co_await_timed_out(self) && co_is_terminated(&tg.obj));
+
+	/* Timeout of zero gives up on the next turn, unless target yields meanwhile */
+	co_fork_run_inplace(self, &tg, target, 50 * MS, 1);
+	co_yield_await_timeout(self, &tg, 0);
+	test_check(co_await_timed_out(self) && tg.obj.await == NULL);
+
+	/* Cancelled caller takes it right away, its deadline goes away with it */
+	co_fork_run_inplace(self, &wt, waiter, &tg, 0);
+	co_yield_return(self, 0);
+	test_check(tg.obj.await == &wt.obj.qe && wt.obj.sleep != NULL);
+	co_get_current_time(&t0);
+	co_cancel(self, &wt);
+	test_check(tg.obj.await == NULL && wt.obj.sleep == NULL);
+	while (!co_is_terminated(&wt.obj)) {
+		co_yield_await(self, &wt);
+	}
+	test_check(wt.args.handled == 1 && ms_since(&t0) < 500 && !co_is_terminated(&tg.obj));
+	co_yield_await_timeout(self, &tg, 500 * MS);
+	test_check(!co_await_timed_out(self) && tg.rv == 1);
+
+	wq.terminate = 1;
+	co_yield_break();
+}
+
+int main(void) {
+	co_allocator_t alloc = co_primitive_allocator_init();
+	struct timeout_main_co_obj *m;
+
+	co_multi_co_wq_init(&wq, 8, &alloc, &alloc);
+	m = co_new(&wq, timeout_main, 0);
+	co_schedule(&wq, m);
+	co_multi_co_wq_loop(&wq);
+	co_multi_co_wq_destroy(&wq);
+	return test_report("timeout");
+}